@@ -26,6 +26,8 @@
 #include "fs.h"
 #include "buf.h"
 
+struct bdevsw bdevsw[NBDEV];
+
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
@@ -33,6 +35,9 @@ struct {
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+
+  // Bounce buffer for bdirect(); never in the list.
+  struct buf direct;
 } bcache;
 
 void
@@ -53,6 +58,7 @@ binit(void)
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
+  initsleeplock(&bcache.direct.lock, "direct buffer");
 }
 
 // Look through buffer cache for block on device dev.
@@ -92,6 +98,15 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// Hand b to the driver of its device.
+static void
+brw(struct buf *b)
+{
+  if(b->dev >= NBDEV || bdevsw[b->dev].rw == 0)
+    panic("brw: no such device");
+  bdevsw[b->dev].rw(b);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
@@ -100,7 +115,7 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
-    iderw(b);
+    brw(b);
   }
   return b;
 }
@@ -112,7 +127,55 @@ bwrite(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
+  brw(b);
+}
+
+// Move block blockno of dev between data and the device
+// without caching it. Returns -1, doing nothing, if the block
+// is cached; the caller must then go through bread(), since
+// the cached copy may be newer than the disk.
+int
+bdirect(uint dev, uint blockno, void *data, int write)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      release(&bcache.lock);
+      return -1;
+    }
+  }
+  release(&bcache.lock);
+
+  b = &bcache.direct;
+  acquiresleep(&b->lock);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  if(write){
+    memmove(b->data, data, BSIZE);
+    b->flags = B_DIRTY;
+  }
+  brw(b);
+  if(!write)
+    memmove(data, b->data, BSIZE);
+  releasesleep(&b->lock);
+  return 0;
+}
+
+// Forget the cached blocks of dev, whose contents are going
+// away. None of them may be in use.
+void
+binval(uint dev)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next)
+    if(b->dev == dev && b->refcnt == 0)
+      b->flags = 0;
+  release(&bcache.lock);
 }
 
 // Release a locked buffer.
@@ -9,6 +9,15 @@ struct buf {
   struct buf *qnext; // disk queue
   uchar data[BSIZE];
 };
+// table mapping block device numbers to drivers
+struct bdevsw {
+  void (*rw)(struct buf*);  // sync buf with the device, as in iderw()
+  uint size;                // blocks, or 0 if unknown
+  void (*release)(uint);    // drop the contents once unmounted, or 0
+};
+
+extern struct bdevsw bdevsw[];
+
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
 
@@ -9,6 +9,11 @@ cat(int fd)
 {
   int n;
 
+  // If either side is a pipe, let the kernel move the data.
+  while((n = splice(fd, 1, 8192)) > 0)
+    ;
+  if(n == 0)
+    return;
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       printf(1, "cat: write error\n");
@@ -16,6 +16,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "poll.h"
 
 static void consputc(int);
 
@@ -285,6 +286,7 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          pollwakeup();
         }
       }
       break;
@@ -296,6 +298,7 @@ consoleintr(int (*getc)(void))
   }
   if(doconsoleswitch){
     cprintf("\nActive console now: %d\n", active);
+    pollwakeup();
   }
 }
 
@@ -353,6 +356,21 @@ consolewrite(struct inode *ip, char *buf, int n)
   return n;
 }
 
+// A console can be read without blocking once a line has been
+// typed on it while it is active.
+int
+consolepoll(struct inode *ip)
+{
+  int r;
+
+  r = POLLOUT;
+  acquire(&cons.lock);
+  if(input.r != input.w && active == ip->minor)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -360,6 +378,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   ioapicenable(IRQ_KBD, 0);
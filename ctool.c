@@ -4,14 +4,14 @@
 #include "fs.h"
 
 #include "fcntl.h"
-#define BUFF_SIZE 512
+#define COPY_SIZE (64*1024)
 
-// Helper function to copy files into the directory for create
+// Helper function to copy files into the directory for create.
+// The data never leaves the kernel; see fcopy().
 void
 copy(char* src, char *dst)
 {
-	int srcFD, destFD, nbread;
-	char *buff[BUFF_SIZE];
+	int srcFD, destFD, n;
 
 	srcFD = open(src, O_RDONLY);
 	if(srcFD == -1) {
@@ -24,14 +24,11 @@ copy(char* src, char *dst)
 		printf(1, "\nError opening file errno = %d\n");
 	}
 
-	while((nbread = read(srcFD,buff,BUFF_SIZE)) > 0)
-	{
-		if(write(destFD,buff,nbread) != nbread)
-		printf(1, "\nError in writing data to %s\n", dst);
-	}
+	while((n = fcopy(srcFD, destFD, COPY_SIZE)) > 0)
+		;
 
-	if(nbread == -1)
-		printf(1, "\nError in reading data from %s\n", src);
+	if(n == -1)
+		printf(1, "\nError in copying data from %s to %s\n", src, dst);
 	
 	if(close(srcFD) == -1)
 		printf(1, "\nError in closing file %s\n", src);
@@ -40,56 +37,66 @@ copy(char* src, char *dst)
 		printf(1, "\nError in closing file %s\n", dst);
 }
 
-// Traverses the filesystem upon start to get an initial used_disk
-int
-ls_help(char *path)
+// Makes dst share src's data blocks, falling back to a copy
+// when the two cannot share (e.g. src is not a plain file).
+void
+clonefile(char *src, char *dst)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
-  struct stat st;
-  int used_disk;
-
-  if((fd = open(path, 0)) < 0){
-    printf(2, "start: cannot open %s\n", path);
-    return -1;
-  }
-
-  if(fstat(fd, &st) < 0){
-    printf(2, "start: cannot stat %s\n", path);
-    close(fd);
-    return -1;
-  }
-
-  switch(st.type){
-  case T_FILE:
-    printf(1, "%s is not a directory! \n", path);
-    return -1;
-    break;
-
-  case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf(1, "start: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf(1, "start: cannot stat %s\n", buf);
-        continue;
-      }
-      used_disk += st.size;
-    }
-    break;
-  }
-  close(fd);
-  return used_disk;
+	if(reflink(src, dst) < 0)
+		copy(src, dst);
+}
+
+// Recreates the tree at src under dst, cloning every file.
+// Nothing is copied until a container writes to it.
+void
+clonetree(char *src, char *dst)
+{
+	char sbuf[512], dbuf[512], *sp, *dp;
+	int fd, i, n;
+	struct dirstat ds[8];  // small: this recurses on a one-page stack
+	struct stat st;
+
+	if((fd = open(src, O_RDONLY)) < 0){
+		printf(2, "clone: cannot open %s\n", src);
+		return;
+	}
+	if(fstat(fd, &st) < 0){
+		printf(2, "clone: cannot stat %s\n", src);
+		close(fd);
+		return;
+	}
+	if(st.type != T_DIR){
+		close(fd);
+		clonefile(src, dst);
+		return;
+	}
+	if(strlen(src) + 1 + DIRSIZ + 1 > sizeof sbuf || strlen(dst) + 1 + DIRSIZ + 1 > sizeof dbuf){
+		printf(2, "clone: path too long\n");
+		close(fd);
+		return;
+	}
+	mkdir(dst);
+
+	strcpy(sbuf, src);
+	sp = sbuf + strlen(sbuf);
+	*sp++ = '/';
+	strcpy(dbuf, dst);
+	dp = dbuf + strlen(dbuf);
+	*dp++ = '/';
+	while((n = getdents(fd, ds, sizeof(ds)/sizeof(ds[0]), 1)) > 0){
+		for(i = 0; i < n; i++){
+			if(strcmp(ds[i].name, ".") == 0 || strcmp(ds[i].name, "..") == 0)
+				continue;
+			strcpy(sp, ds[i].name);
+			strcpy(dp, ds[i].name);
+			// Only directories need to be opened again.
+			if(ds[i].st.type == T_DIR)
+				clonetree(sbuf, dbuf);
+			else
+				clonefile(sbuf, dbuf);
+		}
+	}
+	close(fd);
 }
 
 int main(int argc, char **argv) {
@@ -113,9 +120,21 @@ int main(int argc, char **argv) {
  		*/
  	if (strcmp(argv[1], "start") == 0) {
  		if (argc < 5) {
- 			printf(1, "usage: ctool start <vc#> <container directory> [-p <max_processes>] [-m <max_memory>] [-d <max_disk>] prog [arg1 arg2 ...]\n");
+ 			printf(1, "usage: ctool start <vc#> <container directory> [-b <base directory>] [-p <max_processes>] [-m <max_memory>] [-d <max_disk>] prog [arg1 arg2 ...]\n");
  			exit();
  		}
+ 		char *base = 0;
+ 		if (strcmp(argv[4], "-b") == 0 && argc > 6) {
+ 			// The container's root is layered over a shared base directory;
+ 			// drop the flag so the rest is parsed as before
+ 			base = argv[5];
+ 			int k;
+ 			for (k = 3 ; k >= 0 ; k--) {
+ 				argv[k + 2] = argv[k];
+ 			}
+ 			argv += 2;
+ 			argc -= 2;
+ 		}
  		int proc = 0;
  		int mem = 0;
  		int disk = 0;
@@ -160,12 +179,6 @@ int main(int argc, char **argv) {
  		}
  		// No flags given
 
- 		// Checks if argv[3] is a valid directory and traverses it to find the starting used_disk of the container
- 		int used_disk = ls_help(argv[3]);
- 		if (used_disk < 0) {
- 			exit();
- 		}
-
  		//execute start
  		char *minor = (char*)malloc(4);
  		char b;
@@ -177,11 +190,29 @@ int main(int argc, char **argv) {
  		int id, fd, cid;
  		int minor_node = atoi(minor) + 2;
 
- 		if ((cid = cstart(minor_node, argv[3], used_disk, proc, mem, disk)) < 0) {
+ 		if ((cid = cstart(minor_node, argv[3], proc, mem, disk)) < 0) {
  			printf(1, "start failed\n");
  			exit();
  		}
 
+ 		if (base != 0 && coverlay(cid, base) < 0) {
+ 			printf(1, "start: cannot use %s as a base\n", base);
+ 			cstop(cid);
+ 			exit();
+ 		}
+
+ 		// Scratch files in /tmp stay in memory: a tmpfs is
+ 		// mounted on the container's tmp directory.
+ 		char tmp[64];
+ 		if (strlen(argv[3]) + 5 <= sizeof tmp) {
+ 			strcpy(tmp, argv[3]);
+ 			strcpy(tmp + strlen(tmp), "/tmp");
+ 			mkdir(tmp);
+ 		}
+ 		if (ctmpfs(cid) < 0) {
+ 			printf(1, "start: no tmpfs for /tmp, using the disk\n");
+ 		}
+
  		fd = open(argv[2], O_RDWR);
 
  		id = cfork(cid);
@@ -222,6 +253,11 @@ int main(int argc, char **argv) {
 
 		wait();
 
+		// Everything put in the directory is charged to the container
+		if (cregister(argv[2]) < 0) {
+			printf(1, "create: cannot register %s\n", argv[2]);
+		}
+
 		// Copying all files into created directory
 		int file_count = 2;
 
@@ -241,13 +277,28 @@ int main(int argc, char **argv) {
 			dst[i + j] = '\0';
 
 
-			copy(argv[file_count], dst);
+			clonefile(argv[file_count], dst);
 			
 
 		}
 		exit();
 	}
 
+	if (strcmp(argv[1], "clone") == 0) {
+
+		if (argc < 4) {
+			printf(1, "usage: ctool clone <template dir> <container dir>\n");
+			exit();
+		}
+
+		mkdir(argv[3]);
+		if (cregister(argv[3]) < 0) {
+			printf(1, "clone: cannot register %s\n", argv[3]);
+		}
+		clonetree(argv[2], argv[3]);
+		exit();
+	}
+
 	if (strcmp(argv[1], "info") == 0) {		
 		if(argc > 2) {
 			printf(1, "usage: ctool info\n");
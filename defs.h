@@ -1,8 +1,12 @@
 struct buf;
 struct container;
+struct dirstat;
+struct pollfd;
+struct vmspace;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -16,6 +20,8 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+int             bdirect(uint, uint, void*, int);
+void            binval(uint);
 
 // console.c
 void            consoleinit(void);
@@ -29,30 +35,56 @@ int             exec(char*, char**);
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
+int             filecopy(struct file*, struct file*, int n);
+int             filesplice(struct file*, struct file*, int n);
 struct file*    filedup(struct file*);
 void            fileinit(void);
+int             filepread(struct file*, char*, int n, uint off);
+int             filepwrite(struct file*, char*, int n, uint off);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int cnt);
+int             fileseek(struct file*, int, int);
 int             filestat(struct file*, struct stat*);
+int             filegetdents(struct file*, struct dirstat*, int, int);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int cnt);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+int             dirwhiteout(struct inode*, char*);
 struct inode*   ialloc(uint, short);
+int             icopy(struct inode*, uint, struct inode*, uint, uint);
 struct inode*   idup(struct inode*);
+int             iclone(struct inode*, struct inode*, uint, uint);
+int             qregister(struct inode*);
+void            qsetlimit(uint, int, uint, uint);
+int             qusage(uint, int);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
+int             ipurge(uint);
+int             mount(struct inode*, uint);
+int             umount(uint, int);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+struct inode*   nameiov(char*, int, struct inode**);
+struct inode*   nameiparentov(char*, char*, struct inode**);
+struct inode*   copyup(struct inode*, char*, struct inode*);
+int             readdirov(struct inode*, struct inode*, char*, uint, uint);
+int             readdirstat(struct inode*, struct inode*, uint*, struct dirstat*, int, int);
 int             readi(struct inode*, char*, uint, uint);
+int             readidirect(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
+int             writeidirect(struct inode*, char*, uint, uint);
 
 // ide.c
 void            ideinit(void);
@@ -67,6 +99,11 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+void            kref(char*);
+int             krefs(char*);
+struct container* kowner(char*);
+void            kdisownpage(char*);
+void            kdisown(struct container*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 int 			get_count();
@@ -87,6 +124,8 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
+void            log_sync(void);
+int             log_due(void);
 void            begin_op();
 void            end_op();
 
@@ -98,17 +137,45 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pcache.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint, int);
+void            pcwrite(struct inode*, uint, char*, uint);
+void            pcinval(uint, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
+int             pipepoll(struct pipe*, int);
+int             pipereadbegin(struct pipe*, char**, int, int);
+void            pipereadend(struct pipe*, int);
+int             pipewritebegin(struct pipe*, char**, int, int);
+void            pipewriteend(struct pipe*, int);
 
 //PAGEBREAK: 16
+// futex.c
+void            futexinit(void);
+int             futexwait(uint, uint);
+int             futexwake(uint, int);
+
+// poll.c
+void            pollinit(void);
+int             poll(struct pollfd*, int, int);
+void            polltick(void);
+void            pollwakeup(void);
+
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             clone(void(*)(void*), void*, void*);
+int             join(void**);
+void            vmrelease(pde_t*, struct vmspace*);
+int             vmshared(struct proc*);
+void            stopthreads(struct proc*);
+void            startthreads(struct proc*);
 int             growproc(int);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -122,11 +189,38 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 
+// ramdisk.c
+void            ramdiskinit(void);
+
+// swap.c
+void            swapinit(uint);
+int             swapout(char*);
+void            swapread(int, char*);
+void            swapfree(int);
+int             swapin(uint*);
+void            swapdisown(struct container*);
+int             swapdump(void);
+
+// zram.c
+void            zraminit(void);
+int             zstore(char*);
+void            zload(int, char*);
+void            zfree(int);
+int             zdump(void);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// shm.c
+void            shminit(void);
+int             shmat(int, uint);
+int             shmdt(uint);
+void            shmhold(int);
+void            shmrelease(int);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -138,6 +232,7 @@ void            popcli(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -153,7 +248,9 @@ char*           strncpy(char*, const char*, int);
 
 // syscall.c
 int             argint(int, int*);
+int             argiov(int, int, struct iovec*, int);
 int             argptr(int, char**, int);
+int             argsrc(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -162,6 +259,19 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// tmpfs.c
+void            tmpfsinit(void);
+int             tmpfsalloc(void);
+void            tmpfsfree(uint);
+void            tmprelease(uint);
+uint            tmpialloc(uint, short);
+void            tmpiload(struct inode*);
+void            tmpiupdate(struct inode*);
+int             tmpread(struct inode*, char*, uint, uint);
+int             tmpwrite(struct inode*, char*, uint, uint);
+char*           tmpdata(struct inode*, uint);
+void            tmptrunc(struct inode*);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
@@ -188,6 +298,18 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+struct vmspace* vmsalloc(void);
+struct vmspace* vmsget(struct proc*);
+int             vmmaptext(struct vmspace*, struct inode*, uint, uint, uint);
+int             vmfaultin(struct proc*, uint, uint, int);
+int             vmswapout(struct proc*, int);
+uint            vmmapshm(struct proc*, char**, int, int);
+uint            vmmap(struct proc*, struct inode*, uint, uint, int, int);
+int             vmunmap(struct proc*, uint, uint);
+int             vmfault(struct proc*, uint, int);
+int             vmsdup(struct proc*, struct proc*);
+void            freeuvm(pde_t*, struct vmspace*);
+int             vmvalid(struct proc*, uint, uint, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -4,9 +4,10 @@
 #include "stat.h"
 #include "user.h"
 #include "fcntl.h"
+#include "fs.h"
 
-#define BLOCKSIZE 512
-#define NBLOCKS 140
+#define BLOCKSIZE BSIZE
+#define NBLOCKS MAXFILE
 
 void
 createfile(char *filename, char *buf, int blocksize, int count, int *totalblocks)
@@ -23,7 +24,7 @@ createfile(char *filename, char *buf, int blocksize, int count, int *totalblocks
 
   for (i = 0; i < count; i++) {
     rv = write(fd, buf, blocksize);
-    if (rv < 0) {
+    if (rv < blocksize) {
       printf(1, "diskbomb: write() failed, exiting.\n");
       exit();
     }
@@ -17,6 +17,7 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
+  struct vmspace *vms, *oldvms;
   struct proc *curproc = myproc();
 
   begin_op();
@@ -26,8 +27,9 @@ exec(char *path, char **argv)
     cprintf("exec: fail\n");
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
   pgdir = 0;
+  vms = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -35,7 +37,7 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pgdir = setupkvm()) == 0)
+  if((pgdir = setupkvm()) == 0 || (vms = vmsalloc()) == 0)
     goto bad;
 
   // Load program into memory.
@@ -49,6 +51,18 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
+    if(!(ph.flags & ELF_PROG_FLAG_WRITE) && ph.filesz == ph.memsz &&
+       ph.vaddr % PGSIZE == 0 && ph.off % PGSIZE == 0 &&
+       ph.vaddr >= PGROUNDUP(sz) && ph.vaddr + ph.memsz <= MMAPBASE){
+      // Read-only text and data come from the page cache,
+      // shared by every process running the program, a page
+      // at a time as they are used.
+      if(ph.memsz > 0 && vmmaptext(vms, ip, ph.vaddr, ph.off, ph.memsz) < 0)
+        goto bad;
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
@@ -95,20 +109,22 @@ exec(char *path, char **argv)
 
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
+  oldvms = curproc->vms;
   curproc->pgdir = pgdir;
+  curproc->vms = vms;
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
-  freevm(oldpgdir);
+  vmrelease(oldpgdir, oldvms);
   return 0;
 
  bad:
-  if(pgdir)
-    freevm(pgdir);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(pgdir)
+    freeuvm(pgdir, vms);
   return -1;
 }
@@ -2,3 +2,18 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_SYNC    0x400  // writes are on disk when write() returns
+#define O_DIRECT  0x800  // whole-block I/O bypasses the buffer cache
+#define O_NONBLOCK 0x1000  // pipe and console I/O fail with EAGAIN, not sleep
+
+// fcntl() commands
+#define F_GETFL   1  // return the file's O_ flags
+#define F_SETFL   2  // set O_SYNC, O_DIRECT and O_NONBLOCK from arg
+
+// Returned negated by reads and writes that would block.
+#define EAGAIN    11
+
+// lseek() whence
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
@@ -6,9 +6,22 @@
 #include "defs.h"
 #include "param.h"
 #include "fs.h"
+#include "stat.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "uio.h"
+#include "poll.h"
+
+// Most bytes written to a file in one log transaction, so that
+// it stays within MAXOPBLOCKS: the i-node, indirect block and
+// quota record, and 2 blocks of slop for non-aligned writes,
+// where each data block may also cost a bitmap block and, for a
+// block shared with a clone, a reference count block.
+// this really belongs lower down, since writei()
+// might be writing a device like the console.
+#define MAXWRITE (((MAXOPBLOCKS-1-1-1-2) / 3) * BSIZE)
 
 struct devsw devsw[NDEV];
 struct {
@@ -32,6 +45,7 @@ filealloc(void)
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
+      f->flags = 0;
       release(&ftable.lock);
       return f;
     }
@@ -75,6 +89,8 @@ fileclose(struct file *f)
   else if(ff.type == FD_INODE){
     begin_op();
     iput(ff.ip);
+    if(ff.lower)
+      iput(ff.lower);
     end_op();
   }
 }
@@ -84,7 +100,7 @@ int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
     iunlock(f->ip);
     return 0;
@@ -92,66 +108,411 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Whether a read of ip would return without sleeping, as far
+// as its device's poll hook can tell. Files are always ready.
+static int
+devready(struct inode *ip)
+{
+  if(ip->type != T_DEV || ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].poll)
+    return 1;
+  return (devsw[ip->major].poll(ip) & POLLIN) != 0;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
 {
   int r;
+  uint off;
 
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return piperead(f->pipe, addr, n, f->flags & O_NONBLOCK);
+  if(f->type == FD_INODE && f->lower){
+    // An overlay directory: list both layers.
+    ilockshared(f->ip);
+    ilockshared(f->lower);
+    acquire(&ftable.lock);
+    off = f->off;
+    release(&ftable.lock);
+    r = readdirov(f->ip, f->lower, addr, off, n);
+    acquire(&ftable.lock);
+    f->off = off + r;
+    release(&ftable.lock);
+    iunlock(f->lower);
+    iunlock(f->ip);
+    return r;
+  }
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    // Readers share the inode lock, so several of them may
+    // be here with the same file; claim [off, off+n) under
+    // ftable.lock. The size cannot change while we hold ip->lock.
+    ilockshared(f->ip);
+    if((f->flags & O_NONBLOCK) && !devready(f->ip)){
+      iunlock(f->ip);
+      return -EAGAIN;
+    }
+    acquire(&ftable.lock);
+    off = f->off;
+    if(f->ip->type != T_DEV && off <= f->ip->size){
+      if(n > f->ip->size - off)
+        n = f->ip->size - off;
+      f->off += n;
+    }
+    release(&ftable.lock);
+    if(f->flags & O_DIRECT)
+      r = readidirect(f->ip, addr, off, n);
+    else
+      r = readi(f->ip, addr, off, n);
     iunlock(f->ip);
     return r;
   }
   panic("fileread");
 }
 
+// Read from file f at offset off, leaving f->off alone.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE || f->lower)
+    return -1;
+  ilockshared(f->ip);
+  if(f->flags & O_DIRECT)
+    r = readidirect(f->ip, addr, off, n);
+  else
+    r = readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Read from file f into cnt buffers, in order.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, n, r, tot;
+  uint off;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE && f->lower == 0 && f->ip->type != T_DEV){
+    // Claim the whole range at once, as fileread() does.
+    for(n = 0, i = 0; i < cnt; i++)
+      n += iov[i].iov_len;
+    ilockshared(f->ip);
+    acquire(&ftable.lock);
+    off = f->off;
+    if(off <= f->ip->size && n > f->ip->size - off)
+      n = f->ip->size - off;
+    if(off <= f->ip->size)
+      f->off += n;
+    release(&ftable.lock);
+    for(tot = 0, i = 0, r = 0; i < cnt && tot < n; i++, tot += r){
+      r = iov[i].iov_len < n - tot ? iov[i].iov_len : n - tot;
+      if((r = readi(f->ip, iov[i].iov_base, off + tot, r)) < 0)
+        break;
+    }
+    iunlock(f->ip);
+    return tot > 0 || r >= 0 ? tot : -1;
+  }
+
+  // Pipes, devices, and overlay directories.
+  for(tot = 0, i = 0; i < cnt; i++){
+    if((r = fileread(f, iov[i].iov_base, iov[i].iov_len)) < 0)
+      return tot > 0 ? tot : r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+// Read up to n entries of directory f into ds; see readdirstat().
+int
+filegetdents(struct file *f, struct dirstat *ds, int n, int withstat)
+{
+  int r;
+  uint off;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilockshared(f->ip);
+  if(f->ip->type != T_DIR){
+    iunlock(f->ip);
+    return -1;
+  }
+  if(f->lower)
+    ilockshared(f->lower);
+  acquire(&ftable.lock);
+  off = f->off;
+  release(&ftable.lock);
+  r = readdirstat(f->ip, f->lower, &off, ds, n, withstat);
+  acquire(&ftable.lock);
+  f->off = off;
+  release(&ftable.lock);
+  if(f->lower)
+    iunlock(f->lower);
+  iunlock(f->ip);
+  return r;
+}
+
 //PAGEBREAK!
+// Write n bytes to f's inode at *off, advancing *off.
+// *off is only used with the inode locked.
+static int
+iwrite(struct file *f, char *addr, int n, uint *off)
+{
+  int r;
+
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size.
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > MAXWRITE)
+      n1 = MAXWRITE;
+
+    begin_op();
+    ilock(f->ip);
+    if(f->flags & O_DIRECT)
+      r = writeidirect(f->ip, addr + i, *off, n1);
+    else
+      r = writei(f->ip, addr + i, *off, n1);
+    if(r > 0)
+      *off += r;
+    iunlock(f->ip);
+    end_op();
+
+    if(r < 0)
+      break;
+    i += r;
+    if(r != n1)
+      break;  // out of quota
+  }
+  if(i > 0 && (f->flags & O_SYNC))
+    log_sync();
+  return i > 0 || n == 0 ? i : -1;
+}
+
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((LOGSIZE-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+    return pipewrite(f->pipe, addr, n, f->flags & O_NONBLOCK);
+  if(f->type == FD_INODE)
+    return iwrite(f, addr, n, &f->off);
+  panic("filewrite");
+}
 
-      if(r < 0)
+// Write cnt buffers to file f, in order. For an inode, if they
+// fit in one transaction they are written under one lock.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, n, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+  for(n = 0, i = 0; i < cnt; i++)
+    n += iov[i].iov_len;
+
+  if(f->type == FD_INODE && n <= MAXWRITE){
+    begin_op();
+    ilock(f->ip);
+    for(tot = 0, i = 0, r = 0; i < cnt; i++){
+      if((r = writei(f->ip, iov[i].iov_base, f->off, iov[i].iov_len)) < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+      f->off += r;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;  // out of quota
     }
-    return i == n ? n : -1;
+    iunlock(f->ip);
+    end_op();
+    if(tot > 0 && (f->flags & O_SYNC))
+      log_sync();
+    return tot > 0 || r >= 0 ? tot : -1;
   }
-  panic("filewrite");
+
+  for(tot = 0, i = 0; i < cnt; i++){
+    if((r = filewrite(f, iov[i].iov_base, iov[i].iov_len)) < 0)
+      return tot > 0 ? tot : r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return iwrite(f, addr, n, &off);
+}
+
+// Set f's offset from whence (see fcntl.h) and return it.
+// The offset may not go past the end of the file, since
+// files cannot have holes.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  uint size;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilockshared(f->ip);
+  size = f->ip->size;
+  if(f->lower){
+    ilockshared(f->lower);
+    size += f->lower->size;
+    iunlock(f->lower);
+  }
+  acquire(&ftable.lock);
+  if(whence == SEEK_CUR)
+    off += f->off;
+  else if(whence == SEEK_END)
+    off += size;
+  else if(whence != SEEK_SET)
+    off = -1;
+  if(off < 0 || (f->ip->type != T_DEV && off > size))
+    off = -1;
+  else
+    f->off = off;
+  release(&ftable.lock);
+  iunlock(f->ip);
+  return off;
 }
 
+
+// Copy up to n bytes from in to out without going through
+// user space, advancing both offsets. Each transaction moves
+// as much as filewrite() would. Returns bytes copied, which
+// is less than n only at the end of in.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+  int r, n1, tot;
+  uint off;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if(in->type != FD_INODE || out->type != FD_INODE || in->ip == out->ip)
+    return -1;
+
+  for(tot = 0; tot < n; tot += r){
+    n1 = n - tot;
+    if(n1 > MAXWRITE)
+      n1 = MAXWRITE;
+
+    begin_op();
+    // Lock in address order so that two copies running in
+    // opposite directions cannot deadlock.
+    if(in->ip < out->ip){
+      ilockshared(in->ip);
+      ilock(out->ip);
+    } else {
+      ilock(out->ip);
+      ilockshared(in->ip);
+    }
+    // in->ip is only share-locked; claim the range as fileread() does.
+    acquire(&ftable.lock);
+    off = in->off;
+    if(off <= in->ip->size && n1 > in->ip->size - off)
+      n1 = in->ip->size - off;
+    in->off += n1;
+    release(&ftable.lock);
+    if((r = icopy(in->ip, off, out->ip, out->off, n1)) > 0)
+      out->off += r;
+    if(r != n1){
+      acquire(&ftable.lock);
+      in->off -= n1 - (r > 0 ? r : 0);
+      release(&ftable.lock);
+    }
+    iunlock(in->ip);
+    iunlock(out->ip);
+    end_op();
+
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < n1 || n1 == 0)
+      return tot + r;
+  }
+  return tot;
+}
+
+// Move up to n bytes from in to out, at least one of which is
+// a pipe, without going through user space: file data goes
+// straight between the buffer cache and the pipe's ring.
+// Returns bytes moved; less than n only at the end of in, or
+// when an O_NONBLOCK pipe would have to wait (-EAGAIN if no
+// bytes moved). in and out may not be the same pipe, which
+// could wait on itself forever.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  int r, m, tot;
+  uint off;
+  char *addr;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if(in->type != FD_PIPE && out->type != FD_PIPE)
+    return -1;
+  if(in->type == FD_PIPE && out->type == FD_PIPE && in->pipe == out->pipe)
+    return -1;
+  if((in->type == FD_INODE && in->lower) || in->type == FD_NONE || out->type == FD_NONE)
+    return -1;
+
+  for(tot = 0, r = 0; tot < n; tot += r){
+    if(in->type == FD_PIPE){
+      // Drain the ring in place into out.
+      if((r = m = pipereadbegin(in->pipe, &addr, n - tot, in->flags & O_NONBLOCK)) <= 0)
+        break;
+      if(out->type == FD_PIPE)
+        r = pipewrite(out->pipe, addr, m, out->flags & O_NONBLOCK);
+      else {
+        if(m > MAXWRITE)
+          m = MAXWRITE;
+        begin_op();
+        ilock(out->ip);
+        if((r = writei(out->ip, addr, out->off, m)) > 0)
+          out->off += r;
+        iunlock(out->ip);
+        end_op();
+      }
+      pipereadend(in->pipe, r > 0 ? r : 0);
+    } else {
+      // Fill the ring in place from in.
+      if((r = m = pipewritebegin(out->pipe, &addr, n - tot, out->flags & O_NONBLOCK)) < 0)
+        break;
+      ilockshared(in->ip);
+      acquire(&ftable.lock);  // claim the range as fileread() does
+      off = in->off;
+      if(in->ip->type != T_DEV && off <= in->ip->size){
+        if(m > in->ip->size - off)
+          m = in->ip->size - off;
+        in->off += m;
+      }
+      release(&ftable.lock);
+      r = readi(in->ip, addr, off, m);
+      iunlock(in->ip);
+      pipewriteend(out->pipe, r > 0 ? r : 0);
+    }
+    if(r < m || r <= 0){
+      if(r > 0)
+        tot += r;
+      break;
+    }
+  }
+  if(tot > 0 && out->type == FD_INODE && (out->flags & O_SYNC))
+    log_sync();
+  return tot > 0 || r >= 0 ? tot : r;
+}
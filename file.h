@@ -5,6 +5,8 @@ struct file {
   char writable;
   struct pipe *pipe;
   struct inode *ip;
+  struct inode *lower; // overlay directory merged with ip, or 0
+  int flags;          // O_SYNC and O_DIRECT
   uint off;
 };
 
@@ -14,6 +16,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // icache hash chain (or free list)
+  struct inode *prev;  // LRU list of unreferenced inodes
+  struct inode *next;
+  uint mdev;          // Device mounted on this directory, or 0
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,6 +28,7 @@ struct inode {
   short minor;
   short nlink;
   uint size;
+  uint owner;
   uint addrs[NDIRECT+1];
 };
 
@@ -30,6 +37,7 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*);  // POLLIN/POLLOUT if ready; 0 for always
 };
 
 extern struct devsw devsw[];
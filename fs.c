@@ -22,10 +22,14 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define CLONEBATCH 4  // blocks copyup shares per transaction
+#define CLAIMBATCH 4  // inodes qregister takes over per transaction
 static void itrunc(struct inode*);
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+static uint iblocks(struct inode*);
+static void qclaim(struct inode*, int, int*);
+// There is one superblock per block device, read when the
+// device is mounted.
+struct superblock sb[NBDEV];
 
 // Read the super block.
 void
@@ -50,25 +54,174 @@ bzero(int dev, int bno)
   brelse(bp);
 }
 
+// Quotas.
+
+// Charge n blocks (refund, if n < 0) to quota slot owner.
+// A charge fails, changing nothing, if it would take the slot
+// past its hard limit, or past its soft limit once QGRACE ticks
+// have gone by since it first went over.
+static int
+qcharge(uint dev, uint owner, int n)
+{
+  struct buf *bp;
+  struct dquota *q;
+
+  if(owner == 0 || owner >= NQUOTA || n == 0)
+    return 0;
+  bp = bread(dev, sb[dev].quotastart);
+  q = (struct dquota*)bp->data + owner;
+  if(n > 0){
+    if(q->hard && q->used + n > q->hard)
+      goto full;
+    if(q->soft && q->used + n > q->soft){
+      if(q->graceend == 0)
+        q->graceend = ticks + QGRACE;
+      else if((int)(ticks - q->graceend) >= 0)
+        goto full;
+    }
+    q->used += n;
+  } else {
+    q->used = q->used < -n ? 0 : q->used + n;
+    if(q->used <= q->soft)
+      q->graceend = 0;
+  }
+  log_write(bp);
+  brelse(bp);
+  return 0;
+
+full:
+  brelse(bp);
+  return -1;
+}
+
+// Set the limits, in bytes, of quota slot on dev.
+// Must be called inside a transaction.
+void
+qsetlimit(uint dev, int slot, uint soft, uint hard)
+{
+  struct buf *bp;
+  struct dquota *q;
+
+  if(slot <= 0 || slot >= NQUOTA)
+    return;
+  bp = bread(dev, sb[dev].quotastart);
+  q = (struct dquota*)bp->data + slot;
+  q->soft = soft / BSIZE;
+  q->hard = hard / BSIZE;
+  if(q->used <= q->soft)
+    q->graceend = 0;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Make directory ip the root of a container's quota record:
+// everything created under it from now on, and the blocks
+// that come with it, are charged to the record. A new record
+// first takes over the tree already there (see qclaim).
+// Returns the record's slot, or -1.
+// Must be called inside a transaction, which taking over a
+// tree ends and begins again; the caller must hold no locks.
+int
+qregister(struct inode *ip)
+{
+  struct buf *bp;
+  struct dquota *q;
+  int slot, n;
+
+  ilock(ip);
+  if(ip->type != T_DIR || ISTMPDEV(ip->dev)){
+    iunlock(ip);
+    return -1;
+  }
+  bp = bread(ip->dev, sb[ip->dev].quotastart);
+  q = (struct dquota*)bp->data;
+  slot = ip->owner;
+  if(slot <= 0 || slot >= NQUOTA || q[slot].root != ip->inum){
+    for(slot = 1; slot < NQUOTA; slot++)
+      if(q[slot].root == 0)
+        break;
+    if(slot == NQUOTA){
+      brelse(bp);
+      iunlock(ip);
+      return -1;
+    }
+    memset(&q[slot], 0, sizeof(q[slot]));
+    q[slot].root = ip->inum;
+    log_write(bp);
+    brelse(bp);
+    // ip may be inside a tree already charged for it.
+    n = iblocks(ip);
+    qcharge(ip->dev, ip->owner, -n);
+    qcharge(ip->dev, slot, n);
+    ip->owner = slot;
+    iupdate(ip);
+    iunlock(ip);
+    n = 0;
+    qclaim(ip, slot, &n);
+    return slot;
+  }
+  brelse(bp);
+  iunlock(ip);
+  return slot;
+}
+
+// Free the quota record rooted at ip, which is being freed.
+static void
+qforget(struct inode *ip)
+{
+  struct buf *bp;
+  struct dquota *q;
+
+  if(ip->owner == 0 || ip->owner >= NQUOTA)
+    return;
+  bp = bread(ip->dev, sb[ip->dev].quotastart);
+  q = (struct dquota*)bp->data + ip->owner;
+  if(q->root == ip->inum){
+    memset(q, 0, sizeof(*q));
+    log_write(bp);
+  }
+  brelse(bp);
+}
+
+// Bytes charged to quota slot on dev.
+int
+qusage(uint dev, int slot)
+{
+  struct buf *bp;
+  int n;
+
+  if(slot <= 0 || slot >= NQUOTA)
+    return 0;
+  bp = bread(dev, sb[dev].quotastart);
+  n = ((struct dquota*)bp->data)[slot].used;
+  brelse(bp);
+  return n * BSIZE;
+}
+
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block for ip, charging ip's owner.
+// Returns 0 if the owner is out of quota.
 static uint
-balloc(uint dev)
+balloc(struct inode *ip)
 {
   int b, bi, m;
   struct buf *bp;
 
+  if(qcharge(ip->dev, ip->owner, 1) < 0)
+    return 0;
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  for(b = 0; b < sb[ip->dev].size; b += BPB){
+    bp = bread(ip->dev, BBLOCK(b, sb[ip->dev]));
+    for(bi = 0; bi < BPB && b + bi < sb[ip->dev].size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
+        if(ip->dev == ROOTDEV)
+          used_disk += BSIZE;
         brelse(bp);
-        bzero(dev, b + bi);
+        bzero(ip->dev, b + bi);
         return b + bi;
       }
     }
@@ -77,21 +230,101 @@ balloc(uint dev)
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Count the blocks in use on dev.
+static int
+bcount(int dev)
+{
+  int b, bi, n;
+  struct buf *bp;
+
+  n = 0;
+  for(b = 0; b < sb[dev].size; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb[dev]));
+    for(bi = 0; bi < BPB && b + bi < sb[dev].size; bi++)
+      if(bp->data[bi/8] & (1 << (bi % 8)))
+        n++;
+    brelse(bp);
+  }
+  return n;
+}
+
+// Return how many extra files share block b, and if payer is
+// not 0, set *payer to the entry's payer (see struct dref).
+static int
+brefcnt(int dev, uint b, uint *payer)
+{
+  struct buf *bp;
+  struct dref *r;
+  int n;
+
+  bp = bread(dev, RBLOCK(b, sb[dev]));
+  r = (struct dref*)bp->data + b % RPB;
+  n = r->n;
+  if(payer)
+    *payer = r->payer;
+  brelse(bp);
+  return n;
+}
+
+// Let one more file share block b, which owner was charged
+// for if no one else has been yet: that slot stays charged
+// for it as long as the block is in use, whoever frees it.
+static void
+brefadd(int dev, uint b, uint owner)
+{
+  struct buf *bp;
+  struct dref *r;
+
+  bp = bread(dev, RBLOCK(b, sb[dev]));
+  r = (struct dref*)bp->data + b % RPB;
+  if(r->n >= MAXREF)
+    panic("brefadd");
+  r->n++;
+  if(r->payer == 0)
+    r->payer = owner + 1;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Free ip's disk block b, or just drop ip's reference to it if
+// it is shared with a clone: quotas count a shared block once,
+// until a clone writes its own copy (see bmapw). The slot that
+// paid for the block is refunded when the last reference goes,
+// whichever file held it; that is ip's owner unless the block
+// has been shared.
 static void
-bfree(int dev, uint b)
+bfree(struct inode *ip, uint b)
 {
   struct buf *bp;
+  struct dref *r;
+  uint owner;
   int bi, m;
 
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb));
+  bp = bread(ip->dev, RBLOCK(b, sb[ip->dev]));
+  r = (struct dref*)bp->data + b % RPB;
+  if(r->n > 0){
+    r->n--;
+    log_write(bp);
+    brelse(bp);
+    return;
+  }
+  owner = ip->owner;
+  if(r->payer){
+    owner = r->payer - 1;
+    r->payer = 0;
+    log_write(bp);
+  }
+  brelse(bp);
+  qcharge(ip->dev, owner, -1);
+  bp = bread(ip->dev, BBLOCK(b, sb[ip->dev]));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  if(ip->dev == ROOTDEV)
+    used_disk -= BSIZE;
   brelse(bp);
 }
 
@@ -120,18 +353,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a cache entry and
+//   increments its ref; iput() decrements ref. An entry whose
+//   ref has fallen to zero stays hashed and valid on the LRU
+//   list, so a later iget() of a hot inode needs no disk read;
+//   such entries are recycled least recently released first.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, while iput() clears ip->valid when it
+//   frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,10 +389,15 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// The cache is a hash table keyed by (dev, inum). It starts
+// with NINODE entries and grows a page at a time, up to
+// NINODEMAX, before it starts recycling unreferenced entries.
+//
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries, the hash chains and the LRU list. Since ip->ref
+// indicates whether an entry is in use, and ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold icache.lock
+// while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -167,23 +406,145 @@ bfree(int dev, uint b)
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *free;  // never-used entries, through hnext
+  int ninode;          // entries handed to the cache so far
+
+  // Linked list of unreferenced inodes, through prev/next.
+  // lru.next is most recently released.
+  struct inode lru;
 } icache;
 
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+
+// Put n fresh entries on the free list.
+// Caller must hold icache.lock (except during icacheinit).
+static void
+ifreeadd(struct inode *ip, int n)
+{
+  icache.ninode += n;
+  for(; n > 0; n--, ip++){
+    initsleeplock(&ip->lock, "inode");
+    ip->hnext = icache.free;
+    icache.free = ip;
+  }
+}
+
+// Grow the cache by one page worth of entries.
+// Returns 0 if the cache is at NINODEMAX or memory is short.
+static int
+igrow(void)
+{
+  char *mem;
+
+  if(icache.ninode >= NINODEMAX)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return 0;
+  // Every container uses the cache, so none is charged for it.
+  kdisownpage(mem);
+  memset(mem, 0, PGSIZE);
+  ifreeadd((struct inode*)mem, PGSIZE / sizeof(struct inode));
+  return 1;
+}
+
+// Unlink ip from the LRU list.
+static void
+lruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  ip->next = ip->prev = 0;
+}
+
+// Unlink ip from its hash chain.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
+  ip->hnext = 0;
+}
+
+// Set up the inode cache. Runs from main(), before
+// userinit() looks up the first process's cwd.
 void
-iinit(int dev)
+icacheinit(void)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+  ifreeadd(icache.inode, NINODE);
+}
 
-  readsb(dev, &sb);
+void
+iinit(int dev)
+{
+  readsb(dev, &sb[dev]);
+  if(sb[dev].magic != FSMAGIC)
+    panic("iinit: no file system");
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
-          sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+ inodestart %d bmap start %d refstart %d\n", sb[dev].size, sb[dev].nblocks,
+          sb[dev].ninodes, sb[dev].nlog, sb[dev].logstart, sb[dev].inodestart,
+          sb[dev].bmapstart, sb[dev].refstart);
+  used_disk = bcount(dev) * BSIZE;
+}
+
+// Make an empty file system of size blocks on dev, with
+// the layout mkfs uses but no log, and write it through.
+static void
+iformat(uint dev, uint size)
+{
+  struct superblock s;
+  struct buf *bp;
+  struct dinode *dip;
+  struct dirent *de;
+  uint b, bi, nmeta;
+
+  memset(&s, 0, sizeof(s));
+  s.size = size;
+  s.ninodes = size / 16;
+  s.logstart = 2;
+  s.inodestart = 2;
+  s.bmapstart = s.inodestart + s.ninodes/IPB + 1;
+  s.refstart = s.bmapstart + size/BPB + 1;
+  s.quotastart = s.refstart + size/RPB + 1;
+  nmeta = s.quotastart + 1;
+  s.nblocks = size - nmeta;
+  s.magic = FSMAGIC;
+
+  // Block nmeta is the root directory's.
+  for(b = 0; b <= nmeta; b++){
+    bp = bread(dev, b);
+    memset(bp->data, 0, BSIZE);
+    if(b == 1)
+      memmove(bp->data, &s, sizeof(s));
+    if(b == s.bmapstart)
+      for(bi = 0; bi <= nmeta; bi++)
+        bp->data[bi/8] |= 1 << (bi % 8);
+    if(b == IBLOCK(ROOTINO, s)){
+      dip = (struct dinode*)bp->data + ROOTINO%IPB;
+      dip->type = T_DIR;
+      dip->nlink = 1;
+      dip->size = 2 * sizeof(*de);
+      dip->addrs[0] = nmeta;
+    }
+    if(b == nmeta){
+      de = (struct dirent*)bp->data;
+      de[0].inum = ROOTINO;
+      safestrcpy(de[0].name, ".", DIRSIZ);
+      de[1].inum = ROOTINO;
+      safestrcpy(de[1].name, "..", DIRSIZ);
+    }
+    bwrite(bp);
+    brelse(bp);
+  }
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -191,7 +552,8 @@ static struct inode* iget(uint dev, uint inum);
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if a tmpfs has run out of inodes.
 struct inode*
 ialloc(uint dev, short type)
 {
@@ -199,8 +561,14 @@ ialloc(uint dev, short type)
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
+  if(ISTMPDEV(dev)){
+    if((inum = tmpialloc(dev, type)) == 0)
+      return 0;
+    return iget(dev, inum);
+  }
+
+  for(inum = 1; inum < sb[dev].ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb[dev]));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
@@ -224,13 +592,18 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  if(ISTMPDEV(ip->dev)){
+    tmpiupdate(ip);
+    return;
+  }
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->owner = ip->owner;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -242,31 +615,41 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **bucket;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  bucket = &icache.hash[IHASH(dev, inum)];
+  for(ip = *bucket; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Not cached. Prefer a never-used entry, then growing the
+  // cache, and only then recycle the least recently released one.
+  if(icache.free == 0)
+    igrow();
+  if((ip = icache.free) != 0){
+    icache.free = ip->hnext;
+  } else {
+    ip = icache.lru.prev;
+    if(ip == &icache.lru)
+      panic("iget: no inodes");
+    lruremove(ip);
+    iunhash(ip);
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *bucket;
+  *bucket = ip;
   release(&icache.lock);
 
   return ip;
@@ -296,14 +679,20 @@ ilock(struct inode *ip)
 
   acquiresleep(&ip->lock);
 
-  if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  if(ip->valid == 0 && ISTMPDEV(ip->dev)){
+    tmpiload(ip);
+    ip->valid = 1;
+    if(ip->type == 0)
+      panic("ilock: no type");
+  } else if(ip->valid == 0){
+    bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->owner = dip->owner;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
@@ -312,7 +701,29 @@ ilock(struct inode *ip)
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode for reading only.
+// Any number of readers may hold the lock at once, so
+// callers must not modify the inode or its content.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  if(ip->valid)
+    return;
+
+  // Filling in the inode from disk is a write; take the
+  // lock exclusively for that. ip->valid cannot be cleared
+  // again while we hold a reference.
+  releasesleep(&ip->lock);
+  ilock(ip);
+  releasesleep(&ip->lock);
+  acquiresleepshared(&ip->lock);
+}
+
+// Unlock the given inode, whichever way it was locked.
 void
 iunlock(struct inode *ip)
 {
@@ -323,8 +734,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry goes
+// on the LRU list and can be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -340,6 +751,8 @@ iput(struct inode *ip)
     if(r == 1){
       // inode has no links and no other references: truncate and free.
       itrunc(ip);
+      if(ip->type == T_DIR && !ISTMPDEV(ip->dev))
+        qforget(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
@@ -348,8 +761,62 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid){
+      // Still good: most recently released goes first.
+      ip->next = icache.lru.next;
+      ip->prev = &icache.lru;
+    } else {
+      // Freed or never read: recycle it before anything else.
+      ip->next = &icache.lru;
+      ip->prev = icache.lru.prev;
+    }
+    ip->next->prev = ip;
+    ip->prev->next = ip;
+    if(ISTMPDEV(ip->dev)){
+      release(&icache.lock);
+      tmprelease(ip->dev);
+      return;
+    }
+  }
+  release(&icache.lock);
+}
+
+// Forget every cached inode of dev that is not in use.
+// Returns the number of inodes of dev still in use.
+// Caller must hold icache.lock.
+static int
+iforget(uint dev)
+{
+  struct inode *ip;
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < NIHASH; i++){
+    for(ip = icache.hash[i]; ip; ip = ip->hnext){
+      if(ip->dev != dev)
+        continue;
+      if(ip->ref > 0)
+        n++;
+      else
+        ip->valid = 0;
+    }
+  }
+  return n;
+}
+
+// Forget every cached inode of dev that is not in use, so a
+// later instance of dev reads its inodes afresh.
+// Returns the number of inodes of dev still in use.
+int
+ipurge(uint dev)
+{
+  int n;
+
+  acquire(&icache.lock);
+  n = iforget(dev);
   release(&icache.lock);
+  return n;
 }
 
 // Common idiom: unlock, then put.
@@ -369,7 +836,8 @@ iunlockput(struct inode *ip)
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, or returns 0
+// if ip's owner is out of quota.
 static uint
 bmap(struct inode *ip, uint bn)
 {
@@ -378,7 +846,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip);
     return addr;
   }
   bn -= NDIRECT;
@@ -386,11 +854,13 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip);
+    if(addr == 0)
+      return 0;
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn]) == 0 && (addr = balloc(ip)) != 0){
+      a[bn] = addr;
       log_write(bp);
     }
     brelse(bp);
@@ -400,6 +870,114 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Like bmap, but for writing: if the nth block of ip is shared
+// with a clone, copy it and give ip the private copy first,
+// which is when ip's owner is charged for it.
+// Returns 0 if ip's owner is out of quota.
+static uint
+bmapw(struct inode *ip, uint bn)
+{
+  uint addr, naddr, *a;
+  struct buf *bp, *from, *to;
+
+  if((addr = bmap(ip, bn)) == 0 || brefcnt(ip->dev, addr, 0) == 0)
+    return addr;
+
+  if((naddr = balloc(ip)) == 0)
+    return 0;
+  from = bread(ip->dev, addr);
+  to = bread(ip->dev, naddr);
+  memmove(to->data, from->data, BSIZE);
+  log_write(to);
+  brelse(from);
+  brelse(to);
+  bfree(ip, addr);
+
+  if(bn < NDIRECT){
+    ip->addrs[bn] = naddr;
+    iupdate(ip);
+  } else {
+    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    a = (uint*)bp->data;
+    a[bn - NDIRECT] = naddr;
+    log_write(bp);
+    brelse(bp);
+  }
+  return naddr;
+}
+
+// Make the empty file dst a clone of src: dst shares every data
+// block of src, and whichever of them writes a block first gets
+// a private copy (see bmapw). Only the indirect block is copied,
+// so that is all dst's owner is charged for until it writes.
+// Only blocks bn up to bn+n are shared by one call, since each
+// writes its reference count; a caller with a large file may
+// share a range per transaction (see copyup), starting at 0.
+// dst takes src's size once the last block is shared.
+// Returns 0, or -1, changing nothing, if a block is shared too
+// widely or dst's owner is out of quota.
+// Caller must hold both locks and be inside a transaction.
+int
+iclone(struct inode *src, struct inode *dst, uint bn, uint n)
+{
+  uint i, end, addr, *a, *b;
+  struct buf *bp, *nbp;
+
+  if(src->type != T_FILE || dst->type != T_FILE || (bn == 0 && dst->size != 0))
+    return -1;
+  if(src->dev != dst->dev || src == dst || ISTMPDEV(src->dev) || bn > MAXFILE)
+    return -1;
+  end = n < MAXFILE - bn ? bn + n : MAXFILE;
+
+  bp = nbp = 0;
+  a = b = 0;
+  if(end > NDIRECT && src->addrs[NDIRECT]){
+    bp = bread(src->dev, src->addrs[NDIRECT]);
+    a = (uint*)bp->data;
+  }
+
+  // Check first so that a failure changes nothing.
+  for(i = bn; i < end; i++){
+    addr = i < NDIRECT ? src->addrs[i] : (a ? a[i - NDIRECT] : 0);
+    if(addr && brefcnt(src->dev, addr, 0) >= MAXREF)
+      goto bad;
+  }
+  if(a && dst->addrs[NDIRECT] == 0 && (dst->addrs[NDIRECT] = balloc(dst)) == 0)
+    goto bad;
+
+  if(a){
+    nbp = bread(dst->dev, dst->addrs[NDIRECT]);
+    b = (uint*)nbp->data;
+  }
+  for(i = bn; i < end; i++){
+    if(i < NDIRECT){
+      if(src->addrs[i])
+        brefadd(src->dev, src->addrs[i], src->owner);
+      dst->addrs[i] = src->addrs[i];
+    } else if(a){
+      if(a[i - NDIRECT])
+        brefadd(src->dev, a[i - NDIRECT], src->owner);
+      b[i - NDIRECT] = a[i - NDIRECT];
+    }
+  }
+  if(nbp){
+    log_write(nbp);
+    brelse(nbp);
+  }
+  if(bp)
+    brelse(bp);
+  if(end == MAXFILE || end * BSIZE >= src->size)
+    dst->size = src->size;
+  iupdate(dst);
+  pcinval(dst->dev, dst->inum);
+  return 0;
+
+bad:
+  if(bp)
+    brelse(bp);
+  return -1;
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -412,9 +990,15 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcinval(ip->dev, ip->inum);
+  if(ISTMPDEV(ip->dev)){
+    tmptrunc(ip);
+    return;
+  }
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      bfree(ip, ip->addrs[i]);
       ip->addrs[i] = 0;
     }
   }
@@ -424,10 +1008,10 @@ itrunc(struct inode *ip)
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        bfree(ip, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfree(ip, ip->addrs[NDIRECT]);
     ip->addrs[NDIRECT] = 0;
   }
 
@@ -436,7 +1020,7 @@ itrunc(struct inode *ip)
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -449,7 +1033,7 @@ stati(struct inode *ip, struct stat *st)
 
 //PAGEBREAK!
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
@@ -466,6 +1050,8 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(ISTMPDEV(ip->dev))
+    return tmpread(ip, dst, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -479,11 +1065,14 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
+// The write comes up short, or fails if nothing could be
+// written, when ip's owner runs out of quota.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
+  int r;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -491,35 +1080,155 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return devsw[ip->major].write(ip, src, n);
   }
 
-  struct proc *curproc = myproc();
-  struct container *cont;
-
   if(off > ip->size || off + n < off)
     return -1;
+  if(ISTMPDEV(ip->dev)){
+    if((r = tmpwrite(ip, src, off, n)) > 0 && ip->type == T_FILE)
+      pcwrite(ip, off, src, r);
+    return r;
+  }
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmapw(ip, off/BSIZE)) == 0)
+      break;  // out of quota
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
-    ip->size = off;
+  if(n > 0){
+    if(off > ip->size)
+      ip->size = off;
+    // bmap() may have added a block to ip->addrs[]
+    // even if nothing could be written to it.
     iupdate(ip);
   }
-  if (curproc != 0) {
-    if ((cont = curproc->cont) != 0) {
-      cont->used_disk += n;
-      if(cont->used_disk > cont->total_disk) {
-        cont->tokill = 1;
-      }
+  if(tot > 0 && ip->type == T_FILE)
+    pcwrite(ip, off - tot, src - tot, tot);
+  if(tot == 0 && n > 0)
+    return -1;
+  return tot;
+}
+
+// Like readi, but whole blocks of a file that are not in the
+// buffer cache go straight from the device to dst without
+// taking up cache buffers (O_DIRECT). Anything unaligned, and
+// the partial block at the end of the file, goes through readi.
+// Caller must hold ip->lock, shared or exclusive.
+int
+readidirect(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, addr;
+  struct buf *bp;
+
+  if(ip->type != T_FILE || ISTMPDEV(ip->dev) || off % BSIZE != 0)
+    return readi(ip, dst, off, n);
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot+BSIZE<=n; tot+=BSIZE, off+=BSIZE, dst+=BSIZE){
+    addr = bmap(ip, off/BSIZE);
+    if(bdirect(ip->dev, addr, dst, 0) < 0){
+      bp = bread(ip->dev, addr);
+      memmove(dst, bp->data, BSIZE);
+      brelse(bp);
+    }
+  }
+  if(tot < n)
+    tot += readi(ip, dst, off, n - tot);
+  return tot;
+}
+
+// Like writei, but whole blocks that the file already has
+// and that are not in the buffer cache go straight from src to
+// the device (O_DIRECT). They are written at once rather than
+// with the transaction. Writes that are unaligned or grow the
+// file go through writei.
+// Caller must hold ip->lock and be inside a transaction.
+int
+writeidirect(struct inode *ip, char *src, uint off, uint n)
+{
+  uint tot, addr;
+  struct buf *bp;
+  int r;
+
+  if(ip->type != T_FILE || ISTMPDEV(ip->dev) || off % BSIZE != 0 ||
+     off + n < off || off + n > ip->size)
+    return writei(ip, src, off, n);
+
+  for(tot=0; tot+BSIZE<=n; tot+=BSIZE, off+=BSIZE, src+=BSIZE){
+    if((addr = bmapw(ip, off/BSIZE)) == 0)
+      return tot > 0 ? tot : -1;  // out of quota
+    if(bdirect(ip->dev, addr, src, 1) < 0){
+      bp = bread(ip->dev, addr);
+      memmove(bp->data, src, BSIZE);
+      log_write(bp);
+      brelse(bp);
+    }
+    pcwrite(ip, off, src, BSIZE);
+  }
+  if(tot < n){
+    if((r = writei(ip, src, off, n - tot)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+  }
+  return tot;
+}
+
+// Copy n bytes at soff in src to doff in dst, straight from
+// src's buffer cache blocks into dst's, with no bounce buffer.
+// Stops early at the end of src. Returns bytes copied or -1.
+// Caller must hold both inodes' locks (src may be shared) and
+// be inside a transaction; src and dst must differ.
+int
+icopy(struct inode *src, uint soff, struct inode *dst, uint doff, uint n)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(src->type != T_FILE || dst->type != T_FILE || src == dst)
+    return -1;
+  if(soff > src->size || soff + n < soff)
+    return -1;
+  if(soff + n > src->size)
+    n = src->size - soff;
+
+  if(ISTMPDEV(src->dev)){
+    for(tot=0; tot<n; tot+=m, soff+=m, doff+=m){
+      m = min(n - tot, PGSIZE - soff%PGSIZE);
+      r = writei(dst, tmpdata(src, soff), doff, m);
+      if(r < 0)
+        return tot > 0 ? tot : -1;
+      if(r != m)
+        return tot + r;
     }
+    return n;
+  }
+
+  for(tot=0; tot<n; tot+=m, soff+=m, doff+=m){
+    m = min(n - tot, BSIZE - soff%BSIZE);
+    // If dst is a clone of src, the block being written may
+    // be the very one we are about to hold; unshare it first.
+    if(doff < dst->size && !ISTMPDEV(dst->dev))
+      bmapw(dst, doff/BSIZE);
+    if((doff + m - 1)/BSIZE != doff/BSIZE && doff + m - 1 < dst->size
+       && !ISTMPDEV(dst->dev))
+      bmapw(dst, (doff + m - 1)/BSIZE);
+    bp = bread(src->dev, bmap(src, soff/BSIZE));
+    r = writei(dst, (char*)bp->data + soff%BSIZE, doff, m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r != m)
+      return tot + r;
   }
-  used_disk += n;
   return n;
 }
 
@@ -532,12 +1241,14 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
+// Look for a directory entry in a directory and return its
+// inum, which may be WHITEOUT, or 0 if there is none.
 // If found, set *poff to byte offset of entry.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+// Caller must hold dp->lock, shared or exclusive.
+static uint
+dirscan(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off;
   struct dirent de;
 
   if(dp->type != T_DIR)
@@ -552,22 +1263,43 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       // entry matches path element
       if(poff)
         *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      return de.inum;
     }
   }
 
   return 0;
 }
 
+// Look for a directory entry in a directory.
+// If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock, shared or exclusive.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint inum;
+
+  inum = dirscan(dp, name, poff);
+  if(inum == 0 || inum == WHITEOUT)
+    return 0;
+  return iget(dp->dev, inum);
+}
+
+// Does dp hide name in the lower layer?
+// Caller must hold dp->lock.
+int
+dirwhiteout(struct inode *dp, char *name)
+{
+  return dirscan(dp, name, 0) == WHITEOUT;
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
+// The entry replaces a whiteout of the same name, if there is one.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
   struct inode *ip;
-  struct proc *curproc = myproc();
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -576,23 +1308,19 @@ dirlink(struct inode *dp, char *name, uint inum)
   }
 
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dirscan(dp, name, (uint*)&off) != WHITEOUT){
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
- 
-  if (curproc->cont !=0) {
-    if (curproc->cont->tokill) {
-      kill_cont(curproc->cont->cid);
-    }
-  }
+    return -1;  // out of quota
 
   return 0;
 }
@@ -637,69 +1365,647 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Blocks of ip charged to ip's owner: those that have never
+// been shared, counting the indirect block. A shared block
+// stays charged to whoever paid for it first (see brefadd).
+// Caller must hold ip->lock.
+static uint
+iblocks(struct inode *ip)
+{
+  uint i, n, payer, *a;
+  struct buf *bp;
+
+  n = 0;
+  for(i = 0; i < NDIRECT; i++)
+    if(ip->addrs[i] && brefcnt(ip->dev, ip->addrs[i], &payer) == 0 && payer == 0)
+      n++;
+  if(ip->addrs[NDIRECT]){
+    n++;
+    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    a = (uint*)bp->data;
+    for(i = 0; i < NINDIRECT; i++)
+      if(a[i] && brefcnt(ip->dev, a[i], &payer) == 0 && payer == 0)
+        n++;
+    brelse(bp);
+  }
+  return n;
+}
+
+// Give the inodes under directory dp that no quota record owns
+// yet to slot, charging it for their unshared blocks. Inodes
+// already owned, such as another container's tree inside this
+// one, are left alone, and so is everything under them.
+// Holds no lock while it ends and begins the transaction every
+// CLAIMBATCH inodes (*n counts them), so that a large tree
+// cannot overflow the log.
+static void
+qclaim(struct inode *dp, int slot, int *n)
+{
+  uint off;
+  int dir;
+  struct dirent de;
+  struct inode *ip;
+
+  for(off = 0; ; off += sizeof(de)){
+    ilockshared(dp);
+    if(off >= dp->size){
+      iunlock(dp);
+      return;
+    }
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("qclaim read");
+    iunlock(dp);
+    if(de.inum == 0 || de.inum == WHITEOUT)
+      continue;
+    if(namecmp(de.name, ".") == 0 || namecmp(de.name, "..") == 0)
+      continue;
+
+    if(++*n % CLAIMBATCH == 0){
+      end_op();
+      begin_op();
+    }
+    ip = iget(dp->dev, de.inum);
+    ilock(ip);
+    dir = 0;
+    if(ip->owner == 0){
+      ip->owner = slot;
+      qcharge(ip->dev, slot, iblocks(ip));
+      iupdate(ip);
+      dir = ip->type == T_DIR;
+    }
+    iunlock(ip);
+    if(dir)
+      qclaim(ip, slot, n);
+    iput(ip);
+  }
+}
+
+//PAGEBREAK!
+// Overlays
+
+// A container with a lower_dir sees the union of its own tree
+// under root_dir (the upper layer) and the shared, read-only tree
+// under lower_dir. Names in the upper layer win. Anything about
+// to be modified is first copied up, so the lower layer is never
+// written and every container can share it in the buffer cache.
+
+// If ip is the root of an overlay container, return its lower layer.
+static struct inode*
+ovroot(struct inode *ip)
+{
+  struct container *cont;
+  struct inode *lp;
+
+  // Read lower_dir once: kill_cont clears it.
+  if(myproc() == 0 || (cont = myproc()->cont) == 0 || (lp = cont->lower_dir) == 0)
+    return 0;
+  if(ip->dev != cont->root_dir->dev || ip->inum != cont->root_dir->inum)
+    return 0;
+  return idup(lp);
+}
+
+// Can lower inode lp be copied up? Only directories can be
+// stepped through, and devices are used in place.
+static int
+copyable(struct inode *lp, int last)
+{
+  short type;
+
+  ilockshared(lp);
+  type = lp->type;
+  iunlock(lp);
+  return type == T_DIR || (type == T_FILE && last);
+}
+
+// Make an upper copy of lower inode lp as name in the upper
+// directory dp, which the caller holds locked. A directory starts
+// out empty and lets the lower entries show through; a file shares
+// lp's blocks until it is written (see iclone).
+// Returns the new inode unlocked, or 0.
+// Must be called inside a transaction, which copying a file ends
+// and begins again.
+struct inode*
+copyup(struct inode *dp, char *name, struct inode *lp)
+{
+  struct inode *ip;
+  uint bn, nblocks, inum;
+  short type;
+  int r;
+
+  ilockshared(lp);
+  type = lp->type;
+  iunlock(lp);
+  if(type != T_DIR && type != T_FILE)
+    return 0;
+
+  ip = ialloc(dp->dev, type);
+  ilock(ip);
+  ip->nlink = 1;
+  ip->owner = dp->owner;
+  iupdate(ip);
+  if(type == T_DIR){
+    if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
+      goto bad;
+  } else {
+    // Share lp's blocks a few at a time, each batch in its own
+    // transaction, as filewrite does, so that a large file cannot
+    // overflow the log. dp is unlocked meanwhile so that no one
+    // waits for it while holding up the log; ip is not yet visible
+    // to anyone else, so taking lp's lock second cannot deadlock.
+    iunlock(dp);
+    ilockshared(lp);
+    nblocks = (lp->size + BSIZE - 1) / BSIZE;
+    iunlock(lp);
+    r = 0;
+    for(bn = 0; r == 0 && bn < nblocks; bn += CLONEBATCH){
+      end_op();
+      begin_op();
+      ilockshared(lp);
+      r = iclone(lp, ip, bn, CLONEBATCH);
+      iunlock(lp);
+    }
+    end_op();
+    begin_op();
+    ilock(dp);
+    if(r < 0)
+      goto bad;
+    if((inum = dirscan(dp, name, 0)) != 0){
+      // Someone else copied it up, or removed it, first.
+      ip->nlink = 0;
+      iupdate(ip);
+      iunlockput(ip);
+      return inum == WHITEOUT ? 0 : iget(dp->dev, inum);
+    }
+  }
+  if(dirlink(dp, name, ip->inum) < 0)
+    goto bad;
+  if(type == T_DIR){
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
+  iunlock(ip);
+  return ip;
+
+bad:
+  // Out of quota: nothing refers to ip yet, so let it go.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  return 0;
+}
+
+// Read directory entries of the union of upper directory ip and
+// lower directory lp, starting at off: first ip's entries, then
+// lp's at offsets past ip->size. Hidden entries read as empty.
+// Caller must hold both locks, upper first.
+int
+readdirov(struct inode *ip, struct inode *lp, char *dst, uint off, uint n)
+{
+  uint tot;
+  struct dirent de;
+
+  for(tot = 0; tot + sizeof(de) <= n; tot += sizeof(de), off += sizeof(de)){
+    if(off < ip->size){
+      if(readi(ip, (char*)&de, off, sizeof(de)) != sizeof(de))
+        break;
+      if(de.inum == WHITEOUT)
+        de.inum = 0;
+    } else if(off - ip->size < lp->size){
+      if(readi(lp, (char*)&de, off - ip->size, sizeof(de)) != sizeof(de))
+        break;
+      if(de.inum != 0 && dirscan(ip, de.name, 0) != 0)
+        de.inum = 0;
+    } else
+      break;
+    memmove(dst + tot, &de, sizeof(de));
+  }
+  return tot;
+}
+
+// Fill in st for inode inum of dev straight from its inode
+// block, which the inode cache writes through to. *bpp holds
+// the last block used and is kept for the next inode if that
+// is in the same block.
+static void
+dirstati(uint dev, uint inum, struct stat *st, struct buf **bpp)
+{
+  struct inode *ip;
+  struct dinode *dip;
+  uint b;
+
+  if(ISTMPDEV(dev)){
+    ip = iget(dev, inum);
+    ilockshared(ip);
+    stati(ip, st);
+    iunlock(ip);
+    iput(ip);
+    return;
+  }
+  b = IBLOCK(inum, sb[dev]);
+  if(*bpp && ((*bpp)->dev != dev || (*bpp)->blockno != b)){
+    brelse(*bpp);
+    *bpp = 0;
+  }
+  if(*bpp == 0)
+    *bpp = bread(dev, b);
+  dip = (struct dinode*)(*bpp)->data + inum%IPB;
+  st->type = dip->type;
+  st->nlink = dip->nlink;
+  st->size = dip->size;
+}
+
+// Copy up to n entries of directory ip, merged with lower
+// directory lp if there is one, into ds from byte *poff on,
+// and advance *poff past them. Free slots and whiteouts are
+// skipped. If withstat, also fill in each entry's stat.
+// Returns the number of entries copied, 0 at the end.
+// Caller must hold ip->lock and lp->lock, shared or exclusive.
+int
+readdirstat(struct inode *ip, struct inode *lp, uint *poff, struct dirstat *ds, int n, int withstat)
+{
+  struct dirent de;
+  struct buf *bp;
+  struct inode *dp;
+  uint off;
+  int i;
+
+  bp = 0;
+  for(i = 0, off = *poff; i < n; off += sizeof(de)){
+    if(lp){
+      if(readdirov(ip, lp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        break;
+      dp = off < ip->size ? ip : lp;
+    } else {
+      if(off >= ip->size || readi(ip, (char*)&de, off, sizeof(de)) != sizeof(de))
+        break;
+      dp = ip;
+    }
+    if(de.inum == 0 || de.inum == WHITEOUT)
+      continue;
+    memset(&ds[i], 0, sizeof(ds[i]));
+    memmove(ds[i].name, de.name, DIRSIZ);
+    ds[i].st.dev = dp->dev;
+    ds[i].st.ino = de.inum;
+    if(withstat)
+      dirstati(dp->dev, de.inum, &ds[i].st, &bp);
+    i++;
+  }
+  if(bp)
+    brelse(bp);
+  *poff = off;
+  return i;
+}
+
+//PAGEBREAK!
+// Mounted file systems.
+//
+// A file system mounted on a directory hides it: namex()
+// steps from the directory to the root of the mounted file
+// system, and looks up ".." at that root in the directory.
+// The table holds a reference to each directory mounted on.
+// icache.lock protects the table and every ip->mdev.
+
+struct {
+  uint dev;             // Device mounted, 0 if free
+  struct inode *mp;     // Directory it is mounted on
+} mounts[NMOUNT];
+
+// Mount dev on directory mp, taking over the reference to mp.
+// A blank block device is formatted first. Fails if mp
+// already has something mounted on it, dev is mounted
+// elsewhere, or dev holds no file system.
+int
+mount(struct inode *mp, uint dev)
+{
+  struct superblock s;
+  int i, m;
+
+  if(dev == 0 || dev == ROOTDEV || (dev < NBDEV && bdevsw[dev].rw == 0))
+    return -1;
+  acquire(&icache.lock);
+  m = -1;
+  for(i = 0; i < NMOUNT; i++){
+    if(mounts[i].dev == dev || (mounts[i].dev && mounts[i].mp == mp))
+      m = -2;
+    else if(mounts[i].dev == 0 && m == -1)
+      m = i;
+  }
+  if(m < 0 || mp->mdev != 0){
+    release(&icache.lock);
+    return -1;
+  }
+  mounts[m].dev = dev;  // claim it while reading dev
+  mounts[m].mp = 0;
+  release(&icache.lock);
+
+  if(dev < NBDEV){
+    readsb(dev, &s);
+    if(s.magic != FSMAGIC && s.size == 0 && bdevsw[dev].size > 0){
+      iformat(dev, bdevsw[dev].size);
+      readsb(dev, &s);
+    }
+    if(s.magic != FSMAGIC){
+      acquire(&icache.lock);
+      mounts[m].dev = 0;
+      release(&icache.lock);
+      return -1;
+    }
+    sb[dev] = s;
+  }
+
+  acquire(&icache.lock);
+  mounts[m].mp = mp;
+  mp->mdev = dev;
+  release(&icache.lock);
+  return 0;
+}
+
+// Unmount dev. Fails if any of its inodes is in use, unless
+// force is set; then those go on working, cut off from the
+// rest of the tree. Otherwise a device that keeps its contents
+// in memory lets go of them (see bdevsw.release).
+// Must be called inside a transaction since it calls iput().
+int
+umount(uint dev, int force)
+{
+  struct inode *mp;
+  int i, busy;
+
+  acquire(&icache.lock);
+  for(i = 0; i < NMOUNT; i++)
+    if(mounts[i].dev == dev && mounts[i].mp != 0)
+      break;
+  if(i == NMOUNT || ((busy = iforget(dev)) > 0 && !force)){
+    release(&icache.lock);
+    return -1;
+  }
+  mp = mounts[i].mp;
+  mp->mdev = 0;
+  mounts[i].mp = 0;  // dev stays claimed until released
+  release(&icache.lock);
+  pcinval(dev, 0);
+  if(busy == 0 && dev < NBDEV && bdevsw[dev].release)
+    bdevsw[dev].release(dev);
+  acquire(&icache.lock);
+  mounts[i].dev = 0;
+  release(&icache.lock);
+  iput(mp);
+  return 0;
+}
+
+// Return the root of the file system mounted on ip, or 0.
+static struct inode*
+mounted(struct inode *ip)
+{
+  uint dev;
+
+  acquire(&icache.lock);
+  dev = ip->mdev;
+  release(&icache.lock);
+  if(dev == 0)
+    return 0;
+  return iget(dev, ROOTINO);
+}
+
+// If ip is the root of a mounted file system, return
+// the directory it is mounted on, or else 0.
+static struct inode*
+mountedon(struct inode *ip)
+{
+  struct inode *mp;
+  int i;
+
+  if(ip->inum != ROOTINO || ip->dev == ROOTDEV)
+    return 0;
+  mp = 0;
+  acquire(&icache.lock);
+  for(i = 0; i < NMOUNT; i++){
+    if(mounts[i].dev == ip->dev && mounts[i].mp != 0){
+      mp = mounts[i].mp;
+      mp->ref++;
+      break;
+    }
+  }
+  release(&icache.lock);
+  return mp;
+}
+
+// Is ip the root directory of the current process's container?
+static int
+controot(struct inode *ip)
+{
+  struct container *cont;
+
+  if(myproc() == 0 || (cont = myproc()->cont) == 0)
+    return 0;
+  return ip->dev == cont->root_dir->dev && ip->inum == cont->root_dir->inum;
+}
+
+//PAGEBREAK!
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
+// In an overlay container, if up != 0 copy everything stepped into
+// up into the upper layer, and if plower != 0 return in *plower the
+// lower directory that the returned one merges with.
 // Must be called inside a transaction since it calls iput().
 static struct inode*
-namex(char *path, int nameiparent, char *name)
+namex(char *path, int nameiparent, char *name, int up, struct inode **plower)
 {
-  struct inode *ip, *next;
+  struct inode *ip, *lp, *next, *nlp, *uparent, *mnt;
   struct proc *curproc = myproc();
   struct container *cont;
+  int depth, opaque;
+  uint inum;
 
+  lp = uparent = 0;
+  depth = 0;
   if(*path == '/') {
-    ip = iget(ROOTDEV, ROOTINO); 
-    if (curproc != 0) {
-      if ((cont = curproc->cont) != 0) {
-        ip = iget(cont->root_dir->dev, cont->root_dir->inum);
-      }
+    if (curproc != 0 && (cont = curproc->cont) != 0) {
+      ip = iget(cont->root_dir->dev, cont->root_dir->inum);
+    } else {
+      ip = iget(ROOTDEV, ROOTINO);
     }
+    lp = ovroot(ip);
   } else {
     ip = idup(myproc()->cwd);
+    if(myproc()->cwdlower)
+      lp = idup(myproc()->cwdlower);
   }
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    if(ip == 0){
+      // Below a directory only the lower layer has, until
+      // ".." climbs back up to uparent.
+      ilockshared(lp);
+      if(lp->type != T_DIR){
+        iunlockput(lp);
+        lp = 0;
+        goto fail;
+      }
+      next = dirlookup(lp, name, 0);
+      iunlockput(lp);
+      if((lp = next) == 0)
+        goto fail;
+      if(namecmp(name, "..") == 0){
+        if(--depth == 0){
+          ip = uparent;
+          uparent = 0;
+        }
+      } else if(namecmp(name, ".") != 0)
+        depth++;
+      continue;
+    }
+
+    // ".." at the root of a mounted file system is ".."
+    // of the directory it is mounted on.
+    if(namecmp(name, "..") == 0 && !controot(ip) && (next = mountedon(ip)) != 0){
+      iput(ip);
+      ip = next;
+      if(lp)
+        iput(lp);
+      lp = ovroot(ip);
+    }
+
+    // Lookups only read directories; share the lock.
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
-      return 0;
+      iunlock(ip);
+      goto fail;
+    }
+    opaque = ip->major == OPAQUE;
+    if(opaque && lp){
+      iunlock(ip);
+      iput(lp);
+      lp = 0;
+      ilockshared(ip);
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
       iunlock(ip);
-      return ip;
-    }
-    if((next = dirlookup(ip, name, 0)) == 0) {
-      iunlockput(ip);
-      return 0;
+      goto out;
     }
     // If in container's root and '..' is parsed, will use the container's root instead
-    if (curproc != 0) {
-      if ((cont = curproc->cont) != 0 && ip->inum == cont->root_dir->inum && strncmp("..", name, strlen("..")) == 0) {
-        next = iget(cont->root_dir->dev, cont->root_dir->inum);
+    if (controot(ip) && namecmp(name, "..") == 0) {
+      iunlock(ip);
+      continue;
+    }
+    inum = dirscan(ip, name, 0);
+    iunlock(ip);
+    if(inum == WHITEOUT)
+      goto fail;
+
+    nlp = 0;
+    if(lp){
+      ilockshared(lp);
+      if(lp->type == T_DIR)
+        nlp = dirlookup(lp, name, 0);
+      iunlock(lp);
+    }
+
+    if(inum != 0){
+      next = iget(ip->dev, inum);
+    } else if(nlp != 0 && up && copyable(nlp, *path == '\0')){
+      // Copy the lower entry up before stepping into it,
+      // unless someone else got there first.
+      ilock(ip);
+      if((inum = dirscan(ip, name, 0)) == 0)
+        next = copyup(ip, name, nlp);
+      else if(inum != WHITEOUT)
+        next = iget(ip->dev, inum);
+      else
+        next = 0;
+      iunlock(ip);
+      if(next == 0){
+        iput(nlp);
+        goto fail;
+      }
+    } else if(nlp != 0){
+      // Only the lower layer has it.
+      uparent = ip;
+      depth = 1;
+      ip = 0;
+      if(lp)
+        iput(lp);
+      lp = nlp;
+      continue;
+    } else
+      goto fail;
+
+    // Step onto whatever is mounted there; it hides
+    // the lower layer too.
+    if((mnt = mounted(next)) != 0){
+      iput(next);
+      next = mnt;
+      if(nlp){
+        iput(nlp);
+        nlp = 0;
       }
     }
 
-    iunlockput(ip);
+    iput(ip);
     ip = next;
+    if(lp)
+      iput(lp);
+    if((lp = nlp) == 0)
+      lp = ovroot(ip);
   }
-  if(nameiparent){
-    iput(ip);
-    return 0;
+  if(nameiparent)
+    goto fail;
+  if(ip == 0){
+    if(uparent)
+      iput(uparent);
+    if(plower)
+      *plower = 0;
+    return lp;
   }
+
+out:
+  if(plower)
+    *plower = lp;
+  else if(lp)
+    iput(lp);
   return ip;
+
+fail:
+  if(ip)
+    iput(ip);
+  if(lp)
+    iput(lp);
+  if(uparent)
+    iput(uparent);
+  return 0;
 }
 
 struct inode*
 namei(char *path)
 {
   char name[DIRSIZ];
-  return namex(path, 0, name);
+  return namex(path, 0, name, 0, 0);
 }
 
+// Parents are only looked up to be modified, so in an
+// overlay they are always copied up.
 struct inode*
 nameiparent(char *path, char *name)
 {
-  return namex(path, 1, name);
+  return namex(path, 1, name, 1, 0);
+}
+
+// namei for overlay containers: copy the inode up first if
+// up != 0, and return the lower directory the result merges
+// with in *plower (or 0).
+struct inode*
+nameiov(char *path, int up, struct inode **plower)
+{
+  char name[DIRSIZ];
+  return namex(path, 0, name, up, plower);
+}
+
+// nameiparent, also returning the lower directory the parent
+// merges with in *plower (or 0).
+struct inode*
+nameiparentov(char *path, char *name, struct inode **plower)
+{
+  return namex(path, 1, name, 1, plower);
 }
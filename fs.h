@@ -7,7 +7,8 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                    free bit map | block refcounts | quotas | data blocks]
+// followed, on the root device, by swap space (see swap.c).
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -19,9 +20,16 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint refstart;     // Block number of first block refcount block
+  uint quotastart;   // Block number of the quota block
+  uint swapstart;    // Block number of the first swap block
+  uint nswap;        // Number of swap blocks
+  uint magic;        // Must be FSMAGIC
 };
 
-#define NDIRECT 12
+#define FSMAGIC 0x10203040
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
 
@@ -32,6 +40,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
+  uint owner;           // Quota slot charged for its blocks, or 0
   uint addrs[NDIRECT+1];   // Data block addresses
 };
 
@@ -47,6 +56,35 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
 
+// Refcounts per block. A block's count is the number of extra
+// files sharing it through reflink(); 0 means a single owner.
+// Once a block has been shared, its entry also remembers the
+// quota slot charged for it, plus one, until it is freed.
+struct dref {
+  uchar n;              // Extra files sharing the block
+  uchar payer;          // Quota slot + 1 charged for it, or 0: its owner's
+};
+
+#define RPB           (BSIZE / sizeof(struct dref))
+#define MAXREF        255
+
+// Block of refcounts containing the count for block b
+#define RBLOCK(b, sb) (b/RPB + sb.refstart)
+
+// Disk usage of one container's tree. Every inode under the
+// container root has the record's slot as its owner, and each
+// block an inode references is charged to that slot.
+struct dquota {
+  uint root;            // Inode number of the container root, 0 if free
+  uint used;            // Blocks charged
+  uint soft;            // May be exceeded for QGRACE ticks (0: no limit)
+  uint hard;            // May never be exceeded (0: no limit)
+  uint graceend;        // Tick the soft limit is enforced again, or 0
+};
+
+// Quota records; slot 0 means "no owner".
+#define NQUOTA        (BSIZE / sizeof(struct dquota))
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -55,3 +93,9 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Overlay directories (see namex): a dirent whose inum is WHITEOUT
+// hides the same name in the lower layer, and an upper directory
+// with major == OPAQUE hides the whole lower directory.
+#define WHITEOUT 0xffff
+#define OPAQUE 1
+
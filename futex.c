@@ -0,0 +1,96 @@
+// Futexes: sleeping on a word of user memory.
+//
+// A futex is named by the physical address of the word, so
+// processes that map the same page at different addresses
+// still meet. Waiters sleep on the word's kernel address,
+// which no kernel object can share. futexlock is held from
+// the check of the word's value until the sleep, and by
+// wakers, so a wake between the two cannot be missed.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "fcntl.h"
+
+static struct spinlock futexlock;
+
+void
+futexinit(void)
+{
+  initlock(&futexlock, "futex");
+}
+
+// Fault in the page of the user word at addr, which may
+// sleep, so must be done without futexlock. Returns 0, or -1
+// if addr is not a mapped, aligned user address.
+static int
+futexfault(uint addr)
+{
+  struct proc *curproc = myproc();
+
+  if(addr % 4 != 0)
+    return -1;
+  if(addr < curproc->sz ? vmfaultin(curproc, addr, 4, 0) < 0 : !vmvalid(curproc, addr, 4, 0))
+    return -1;
+  return 0;
+}
+
+// Kernel address of the user word at addr, faulted in first,
+// with futexlock held, or 0 if addr is bad. The page may be
+// gone again by the time the lock is held; then it is faulted
+// in once more.
+static uint*
+futexaddr(uint addr)
+{
+  char *ka;
+
+  for(;;){
+    if(futexfault(addr) < 0)
+      return 0;
+    acquire(&futexlock);
+    if((ka = uva2ka(myproc()->pgdir, (char*)addr)) != 0)
+      return (uint*)(ka + addr % PGSIZE);
+    release(&futexlock);
+  }
+}
+
+// Sleep until woken by futexwake() on the same word, if it
+// still holds val. Returns 0 when woken, -EAGAIN if the word
+// did not hold val, or -1 on a bad address or when killed.
+int
+futexwait(uint addr, uint val)
+{
+  uint *w;
+
+  if((w = futexaddr(addr)) == 0)
+    return -1;
+  if(*w != val){
+    release(&futexlock);
+    return -EAGAIN;
+  }
+  if(myproc()->killed){
+    release(&futexlock);
+    return -1;
+  }
+  sleep(w, &futexlock);
+  release(&futexlock);
+  return 0;
+}
+
+// Wake up to n processes waiting on the word at addr.
+// Returns the number woken.
+int
+futexwake(uint addr, int n)
+{
+  uint *w;
+  int r;
+
+  if((w = futexaddr(addr)) == 0)
+    return -1;
+  r = wakeupn(w, n);
+  release(&futexlock);
+  return r;
+}
@@ -67,6 +67,12 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  bdevsw[0].rw = iderw;
+  if(havedisk1){
+    bdevsw[1].rw = iderw;
+    bdevsw[1].size = FSSIZE + SWAPSIZE;
+  }
 }
 
 // Start the request for b.  Caller must hold idelock.
@@ -75,7 +81,7 @@ idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= FSSIZE + SWAPSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
@@ -28,6 +28,8 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  ushort ref[PHYSTOP/PGSIZE];  // references to each page in use
+  struct container *owner[PHYSTOP/PGSIZE];  // container charged for it
 } kmem;
 
 // Initialization happens in two phases.
@@ -60,15 +62,18 @@ freerange(void *vstart, void *vend)
 
   p = (char*)PGROUNDUP((uint)vstart);
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE) {
+    kmem.ref[V2P(p)/PGSIZE] = 1;
     kfree(p);
   }
 }
 
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator; see
+// kinit above.) The page is credited to the container that
+// kalloc() charged for it, whoever frees it.
 void
 kfree(char *v)
 {
@@ -78,6 +83,19 @@ kfree(char *v)
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kfree: free page");
+  if(--kmem.ref[V2P(v)/PGSIZE] > 0){
+    // Still mapped elsewhere; only the last free is charged.
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
@@ -86,12 +104,9 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
-  if (ticks > 0) {
-    if (myproc() != 0) {
-     if ((cont = myproc()->cont) != 0) {
-      cont->used_mem--;
-    }
-  }
+  if((cont = kmem.owner[V2P(v)/PGSIZE]) != 0){
+    cont->used_mem--;
+    kmem.owner[V2P(v)/PGSIZE] = 0;
   }
   used_mem--;
   if(kmem.use_lock)
@@ -107,21 +122,80 @@ kalloc(void)
   struct run *r;
   struct container * cont;
 
+  cont = 0;
+  if (ticks > 0 && myproc() != 0)
+    cont = myproc()->cont;
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
-  used_mem++;
-  if (ticks > 0) {
-    if ((cont = myproc()->cont) != 0) {
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+    kmem.owner[V2P(r)/PGSIZE] = cont;
+    used_mem++;
+    if (cont != 0) {
       cont->used_mem++;
-      if(cont->used_mem > cont->total_mem) {
-        cont->tokill = 1;
-      }
     }
   }
+  if(kmem.use_lock)
+    release(&kmem.lock);
   return (char*)r;
 }
+
+// Add a reference to the page at v, which kfree() will then
+// have to drop before the page is freed.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kref: free page");
+  kmem.ref[V2P(v)/PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// Number of references to the page at v.
+int
+krefs(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Stop charging the page at v to its container, as it holds
+// something all containers share.
+void
+kdisownpage(char *v)
+{
+  struct container *cont;
+
+  acquire(&kmem.lock);
+  if((cont = kmem.owner[V2P(v)/PGSIZE]) != 0){
+    cont->used_mem--;
+    kmem.owner[V2P(v)/PGSIZE] = 0;
+  }
+  release(&kmem.lock);
+}
+
+// The container charged for the page at v, or 0.
+struct container*
+kowner(char *v)
+{
+  return kmem.owner[V2P(v)/PGSIZE];
+}
+
+// Stop charging cont for its pages, as it is being torn down;
+// pages its processes still hold are credited to no one.
+void
+kdisown(struct container *cont)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < PHYSTOP/PGSIZE; i++)
+    if(kmem.owner[i] == cont)
+      kmem.owner[i] = 0;
+  cont->used_mem = 0;
+  release(&kmem.lock);
+}
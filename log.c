@@ -18,7 +18,15 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the last outstanding end_op() finishes,
+// and then commits.
+//
+// Commits are deferred: the last end_op() only commits if
+// log_sync() asked for it or the oldest uncommitted write is
+// COMMITTICKS old. Until then the blocks stay pinned in the
+// buffer cache, and a crash loses them (but never leaves the
+// file system inconsistent). trap() calls log_sync() when
+// log_due() says a commit is overdue and nothing else did it.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -42,6 +50,9 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int syncing;     // log_sync() is waiting for a commit
+  uint ncommit;    // commits so far
+  uint since;      // tick of the oldest uncommitted write
   int dev;
   struct logheader lh;
 };
@@ -49,6 +60,7 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void locked_commit(void);
 
 void
 initlog(int dev)
@@ -130,8 +142,12 @@ begin_op(void)
     if(log.committing){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      // this op might exhaust log space; wait for commit,
+      // or commit the deferred ones if nobody else will.
+      if(log.outstanding == 0)
+        locked_commit();
+      else
+        sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
       release(&log.lock);
@@ -140,20 +156,36 @@ begin_op(void)
   }
 }
 
+// Commit with log.lock held and no operations outstanding.
+// Returns with log.lock held again.
+static void
+locked_commit(void)
+{
+  log.committing = 1;
+  release(&log.lock);
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.syncing = 0;
+  log.ncommit++;
+  wakeup(&log);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and a commit is wanted; see above.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && log.lh.n > 0 &&
+     (log.syncing || ticks - log.since >= COMMITTICKS)){
+    locked_commit();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -161,16 +193,40 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Commit everything written so far, and wait until it is on disk.
+// Must not be called inside a transaction.
+void
+log_sync(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  // A commit already under way holds everything written before
+  // now, since log_write() cannot run while committing.
+  if(log.committing){
+    n = log.ncommit;
+    while(log.ncommit == n)
+      sleep(&log, &log.lock);
+  } else if(log.lh.n > 0 && log.outstanding == 0){
+    locked_commit();
+  } else if(log.lh.n > 0){
+    // The last outstanding end_op() will commit.
+    log.syncing = 1;
+    n = log.ncommit;
+    while(log.ncommit == n)
+      sleep(&log, &log.lock);
   }
+  release(&log.lock);
+}
+
+// Is there a deferred commit that is overdue?
+int
+log_due(void)
+{
+  return log.lh.n > 0 && !log.committing && log.outstanding == 0 &&
+         ticks - log.since >= COMMITTICKS;
 }
 
 // Copy modified blocks from cache to log.
@@ -219,6 +275,12 @@ log_write(struct buf *b)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
+  if (b->dev != log.dev) {
+    // Only the root device has a log; mounted devices are
+    // written through and are not crash safe.
+    bwrite(b);
+    return;
+  }
 
   acquire(&log.lock);
   for (i = 0; i < log.lh.n; i++) {
@@ -226,6 +288,8 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
+  if (log.lh.n == 0)
+    log.since = ticks;
   if (i == log.lh.n)
     log.lh.n++;
   b->flags |= B_DIRTY; // prevent eviction
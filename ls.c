@@ -26,8 +26,8 @@ void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, i, n;
+  struct dirstat ds[32];
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -54,16 +54,13 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf(1, "ls: cannot stat %s\n", buf);
-        continue;
+    // Many entries per call, each with its stat filled in.
+    while((n = getdents(fd, ds, sizeof(ds)/sizeof(ds[0]), 1)) > 0){
+      for(i = 0; i < n; i++){
+        strcpy(p, ds[i].name);
+        st = ds[i].st;
+        printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
       }
-      printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
     break;
   }
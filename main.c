@@ -29,8 +29,15 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  icacheinit();    // inode cache
+  tmpfsinit();     // memory file systems
   fileinit();      // file table
+  pollinit();      // poll() wait queue
+  futexinit();     // futex wait queues
+  shminit();       // shared memory segments
+  pcinit();        // page cache for mmap
   ideinit();       // disk 
+  ramdiskinit();   // ram disks
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
   userinit();      // first user process
@@ -1,4 +1,16 @@
-/* membomb.c - allocate memory, 4KB at a time until malloc fails. */
+/* membomb.c - allocate memory, 1MB at a time until malloc fails.
+ *
+ * membomb <mb> [<passes>] is a benchmark of paging instead: it
+ * allocates mb MB, then goes over every page of it passes times,
+ * checking what the last pass wrote and writing a new pattern,
+ * and prints how many ticks each pass took.  Run it in a container
+ * whose memory limit (in pages) is below mb MB, e.g.
+ *   ctool create c1 membomb
+ *   ctool start vc0 c1 -m 1024 membomb 8 4
+ * and its pages are paged out and back in on every pass.  free in
+ * the root container then shows the compression ratio and how long
+ * page-ins took.
+ */
 
 #include "types.h"
 #include "stat.h"
@@ -6,8 +18,57 @@
 
 #define KB 1024
 #define MB (KB * KB)
+#define PGSIZE 4096
 #define ALLOCMB 1
 #define ALLOCSIZE (ALLOCMB * MB)
+#define STRIDE 64   // bytes between the words a pass writes
+
+// Go over the npages pages at p, checking for the pattern of
+// pass-1 and writing that of pass.  Returns the number of pages
+// that did not hold what the last pass wrote.
+static int
+sweep(char *p, int npages, int pass)
+{
+  int i, j, bad;
+  uint *w;
+
+  bad = 0;
+  for (i = 0; i < npages; i++) {
+    w = (uint *)(p + i * PGSIZE);
+    for (j = 0; j < PGSIZE / STRIDE; j++) {
+      if (pass > 0 && w[j * STRIDE / 4] != (uint)(i * 131 + j + pass - 1)) {
+        bad++;
+        break;
+      }
+    }
+    for (j = 0; j < PGSIZE / STRIDE; j++)
+      w[j * STRIDE / 4] = i * 131 + j + pass;
+  }
+  return bad;
+}
+
+static void
+bench(int mb, int passes)
+{
+  char *p;
+  int pass, start, bad;
+
+  if ((p = malloc(mb * MB)) == 0) {
+    printf(1, "membomb: malloc(%d MB) failed\n", mb);
+    exit();
+  }
+  for (pass = 0; pass <= passes; pass++) {
+    start = uptime();
+    bad = sweep(p, mb * MB / PGSIZE, pass);
+    printf(1, "membomb: pass %d over %d MB: %d ticks\n", pass, mb, uptime() - start);
+    if (bad) {
+      printf(1, "membomb: %d pages lost their contents\n", bad);
+      exit();
+    }
+  }
+  free(p);
+  writemem();
+}
 
 int
 main(int argc, char *argv[])
@@ -15,17 +76,24 @@ main(int argc, char *argv[])
   int totalmb = 0;
   char *p;
 
+  if (argc > 1) {
+    bench(atoi(argv[1]), argc > 2 ? atoi(argv[2]) : 4);
+    exit();
+  }
+
   printf(1, "membomb: started\n");
   while(1) {
     p = (char *) malloc(ALLOCSIZE);
     if (p == 0) {
       printf(1, "membomb: malloc() failed, exiting\n");
       exit();
-    }    
+    }
+    // Touch every page, since big blocks are mapped lazily.
+    memset(p, 1, ALLOCSIZE);
     totalmb += ALLOCMB;
 
     printf(1, "membomb: total memory allocated: %d MB\n", totalmb);
   }
 
   exit();
-}
\ No newline at end of file
+}
@@ -23,6 +23,8 @@ ideinit(void)
 {
   memdisk = _binary_fs_img_start;
   disksize = (uint)_binary_fs_img_size/BSIZE;
+  bdevsw[1].rw = iderw;
+  bdevsw[1].size = disksize;
 }
 
 // Interrupt handler.
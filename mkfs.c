@@ -18,12 +18,14 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map |
+//                                         block refcounts | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
+int nrefblocks = FSSIZE/RPB + 1;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap, refcounts, quotas)
 int nblocks;  // Number of data blocks
 
 int fsfd;
@@ -91,7 +93,7 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nmeta = 2 + nlog + ninodeblocks + nbitmap + nrefblocks + 1;
   nblocks = FSSIZE - nmeta;
 
   sb.size = xint(FSSIZE);
@@ -101,13 +103,18 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.refstart = xint(2+nlog+ninodeblocks+nbitmap);
+  sb.quotastart = xint(2+nlog+ninodeblocks+nbitmap+nrefblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(SWAPSIZE);
+  sb.magic = xint(FSMAGIC);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u, refcount blocks %u, quota blocks 1) blocks %d total %d swap %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nrefblocks, nblocks, FSSIZE, SWAPSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < FSSIZE + SWAPSIZE; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
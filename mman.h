@@ -0,0 +1,11 @@
+// Mapping files into memory, for mmap().
+// Both the kernel and user programs use this header file.
+
+#define PROT_READ   0x1  // pages may be read
+#define PROT_WRITE  0x2  // pages may be written
+
+#define MAP_SHARED  0x1  // share the file's pages with its other users
+#define MAP_PRIVATE 0x2  // writes go to a private copy of each page
+#define MAP_ANON    0x4  // zero-filled memory rather than a file
+
+#define MAP_FAILED  ((void*)-1)  // what mmap() returns on failure
@@ -0,0 +1,17 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  if(argc != 3){
+    printf(2, "Usage: mount dir dev\n");
+    exit();
+  }
+
+  if(mount(argv[1], atoi(argv[2])) < 0)
+    printf(2, "mount: cannot mount device %s on %s\n", argv[2], argv[1]);
+
+  exit();
+}
@@ -4,12 +4,36 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define PIPEPAGES     4  // pages in a pipe's buffer; a power of two
+#define NVMA         64  // mappings above the heap per address space
+#define NSHM         16  // shared memory segments
+#define SHMMAXPG     16  // pages per shared memory segment
+#define NPCACHE      64  // pages of files cached for mmap
+#define SWAPSIZE   4096  // blocks of swap space after the file system
+#define SWAPBATCH     8  // pages paged out beyond a container's excess
+#define SWAPLOW      64  // free pages below which processes page out
+#define ZRAMPAGES   128  // pages of memory for compressed swap space
+#define ZCHUNK      128  // bytes in a unit of compressed swap space
+#define NINODE       50  // i-nodes cached at boot
+#define NINODEMAX   512  // i-node cache may grow to this many
+#define NIHASH       61  // buckets in the i-node cache hash table
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define NBDEV        16  // maximum block device number
+#define RAMDEV        2  // device number of the first ramdisk
+#define NRAMDISK      4  // number of ramdisks
+#define RAMSIZE    2048  // size of a ramdisk in blocks
+#define NMOUNT  (NRAMDISK+NTMPFS+2)  // maximum number of mounted file systems
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*6)  // size of disk block cache
+#define COMMITTICKS  100  // ticks a log commit may be deferred
 #define FSSIZE       50000  // size of file system in blocks
+#define QGRACE       3000  // ticks a container may stay over its soft disk limit
+#define NTMPFS    NCONT  // maximum number of tmpfs instances
+#define NTMPINODE    64  // inodes per tmpfs instance
+#define NTMPPAGE     32  // pages per tmpfs file
+#define TMPDEV       16  // device number of the first tmpfs instance
+#define ISTMPDEV(dev) ((dev) >= TMPDEV && (dev) < TMPDEV + NTMPFS)
 
@@ -0,0 +1,216 @@
+// Page cache: whole pages of files, for mmap().
+//
+// An entry holds one reference to a page filled from a file
+// at a page-aligned offset. Each mapping of the page holds
+// another (see vmfault in vm.c), so processes that map the
+// same part of a file share one copy of it. Shared and private
+// mappings have entries of their own: writei() keeps the pages
+// of shared mappings up to date, but a private mapping's page
+// is left as it was and dropped from the cache, so that writing
+// a file does not change what private mappings of it, such as
+// the text of running programs, already see. A file's pages are
+// dropped when it is truncated or made a clone. When every entry is
+// in use, a clock hand passes over them and reuses the first
+// whose page no mapping is using any more.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+struct pcentry {
+  uint dev;
+  uint inum;    // 0 if the entry is free
+  uint off;     // offset of the page in the file
+  int priv;     // for private mappings: not updated by writes
+  int busy;     // being filled from the file
+  int stale;    // while busy: 1 if written since the fill read, 2 if dropped
+  char *page;
+};
+
+struct {
+  struct spinlock lock;
+  struct pcentry e[NPCACHE];
+  int hand;     // where the clock looks for an entry to reuse next
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Read the page at off in ip into page, zero-filling
+// whatever lies past the end of the file.
+static void
+pcfill(struct inode *ip, uint off, char *page)
+{
+  int n;
+
+  ilockshared(ip);
+  if((n = readi(ip, page, off, PGSIZE)) < 0)
+    n = 0;
+  iunlock(ip);
+  memset(page + n, 0, PGSIZE - n);
+}
+
+// An entry to reuse, or 0 if every page is mapped.
+// Caller must hold pcache.lock.
+static struct pcentry*
+pcvictim(void)
+{
+  struct pcentry *e;
+  int i;
+
+  for(i = 0; i < NPCACHE; i++){
+    e = &pcache.e[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(!e->busy && krefs(e->page) == 1)
+      return e;
+  }
+  return 0;
+}
+
+// Return the page at offset off, a multiple of PGSIZE, in
+// ip, with a reference for the caller, reading it in if it is
+// not cached. If the cache is full of mapped pages, the page
+// is a private copy that is not cached. Returns 0 if out of
+// memory. The caller must hold a reference to ip but not its
+// lock. priv says whether the page is for a private mapping.
+char*
+pcget(struct inode *ip, uint off, int priv)
+{
+  struct pcentry *e, *free;
+  char *page, *old;
+
+  acquire(&pcache.lock);
+again:
+  free = 0;
+  for(e = pcache.e; e < &pcache.e[NPCACHE]; e++){
+    if(e->inum == ip->inum && e->dev == ip->dev && e->off == off && e->priv == priv)
+      break;
+    if(e->inum == 0 && free == 0)
+      free = e;
+  }
+  if(e < &pcache.e[NPCACHE]){
+    if(e->busy){
+      sleep(e, &pcache.lock);
+      goto again;
+    }
+    page = e->page;
+    kref(page);
+    release(&pcache.lock);
+    return page;
+  }
+
+  // Not cached: claim an entry, so that others wait for
+  // this fill rather than reading the page themselves.
+  if(free == 0)
+    free = pcvictim();
+  if(free == 0){
+    release(&pcache.lock);
+    if((page = kalloc()) != 0)
+      pcfill(ip, off, page);
+    return page;
+  }
+  e = free;
+  old = e->inum ? e->page : 0;
+  e->dev = ip->dev;
+  e->inum = ip->inum;
+  e->off = off;
+  e->priv = priv;
+  e->busy = 1;
+  e->stale = 0;
+  e->page = 0;
+  release(&pcache.lock);
+
+  if(old)
+    kfree(old);
+  page = kalloc();
+  // pcfill() unlocks ip before the entry stops being busy, so
+  // a write may land in between; then read the page again.
+  for(;;){
+    if(page)
+      pcfill(ip, off, page);
+    acquire(&pcache.lock);
+    if(e->stale != 1)
+      break;
+    e->stale = 0;
+    release(&pcache.lock);
+  }
+  e->busy = 0;
+  if(page && !e->stale){
+    e->page = page;
+    kref(page);
+  } else
+    e->inum = 0;  // out of memory, or the file's pages were dropped
+  e->stale = 0;
+  wakeup(e);
+  release(&pcache.lock);
+  return page;
+}
+
+// Copy the n bytes at src, just written at off in ip, into
+// ip's cached pages. Called by writei() with ip locked. A page
+// that private mappings are using keeps its old contents for
+// them and leaves the cache instead. A page that is being
+// filled may already have read the old contents, so its fill
+// is marked to be done again.
+void
+pcwrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcentry *e;
+  uint start, end;
+
+  acquire(&pcache.lock);
+  for(e = pcache.e; e < &pcache.e[NPCACHE]; e++){
+    if(e->inum != ip->inum || e->dev != ip->dev)
+      continue;
+    if(e->off >= off + n || e->off + PGSIZE <= off)
+      continue;
+    if(e->busy){
+      if(e->stale == 0)
+        e->stale = 1;
+      continue;
+    }
+    if(e->priv && krefs(e->page) > 1){
+      kfree(e->page);
+      e->inum = 0;
+      e->page = 0;
+      continue;
+    }
+    start = e->off > off ? e->off : off;
+    end = e->off + PGSIZE < off + n ? e->off + PGSIZE : off + n;
+    memmove(e->page + (start - e->off), src + (start - off), end - start);
+  }
+  release(&pcache.lock);
+}
+
+// Drop the cached pages of inode inum on dev, or of every
+// inode on dev if inum is 0. Mappings keep their pages. Pages
+// being filled are dropped once the fill is done.
+void
+pcinval(uint dev, uint inum)
+{
+  struct pcentry *e;
+
+  acquire(&pcache.lock);
+  for(e = pcache.e; e < &pcache.e[NPCACHE]; e++){
+    if(e->inum == 0 || e->dev != dev)
+      continue;
+    if(inum != 0 && e->inum != inum)
+      continue;
+    if(e->busy){
+      e->stale = 2;
+      continue;
+    }
+    kfree(e->page);
+    e->inum = 0;
+    e->page = 0;
+  }
+  release(&pcache.lock);
+}
@@ -7,22 +7,53 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
+// The ring is PIPEPAGES separate pages; byte i of the stream
+// lives at page[(i/PGSIZE)%PIPEPAGES][i%PGSIZE]. PIPEPAGES must
+// be a power of two so that the ring survives nread and nwrite
+// wrapping around.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int nrsleep;    // readers sleeping on nread
+  int nwsleep;    // writers sleeping on nwrite
+  int rbusy;      // a splice is reading the ring without the lock
+  int wbusy;      // a splice is writing the ring without the lock
 };
 
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(p->page[i])
+      kfree(p->page[i]);
+  kfree((char*)p);
+}
+
+// Address of byte off of p's stream, and in *n how many bytes
+// from there on are contiguous.
+static char*
+pipeaddr(struct pipe *p, uint off, uint *n)
+{
+  *n = PGSIZE - off%PGSIZE;
+  return p->page[(off/PGSIZE)%PIPEPAGES] + off%PGSIZE;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
@@ -30,6 +61,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((p->page[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -48,7 +83,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -67,55 +102,228 @@ pipeclose(struct pipe *p, int writable)
     p->readopen = 0;
     wakeup(&p->nwrite);
   }
+  pollwakeup();
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
 //PAGEBREAK: 40
+// Write n bytes to p, sleeping while it is full. If nonblock,
+// write what fits instead, failing with -EAGAIN if nothing does.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
   int i;
+  uint m, room;
+  char *dst;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->nwrite == p->nread + PIPESIZE || p->wbusy){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      if(p->nrsleep)
+        wakeup(&p->nread);
+      if(nonblock)
+        goto out;
+      pollwakeup();
+      p->nwsleep++;
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      p->nwsleep--;
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    // Copy as much as fits before the ring is full or the
+    // current page ends.
+    dst = pipeaddr(p, p->nwrite, &m);
+    room = p->nread + PIPESIZE - p->nwrite;
+    if(m > room)
+      m = room;
+    if(m > n - i)
+      m = n - i;
+    memmove(dst, addr + i, m);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+out:
+  if(p->nrsleep)
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
-  return n;
+  pollwakeup();
+  return i > 0 || n == 0 ? i : -EAGAIN;
 }
 
+// Read up to n bytes from p, sleeping until there is some
+// unless nonblock, in which case fail with -EAGAIN.
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
   int i;
+  uint m;
+  char *src;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  while((p->nread == p->nwrite && p->writeopen) || p->rbusy){  //DOC: pipe-empty
     if(myproc()->killed){
       release(&p->lock);
       return -1;
     }
+    if(nonblock){
+      release(&p->lock);
+      return -EAGAIN;
+    }
+    p->nrsleep++;
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    p->nrsleep--;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    src = pipeaddr(p, p->nread, &m);
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    if(m > n - i)
+      m = n - i;
+    memmove(addr + i, src, m);
+    p->nread += m;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  if(p->nwsleep)
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
+  pollwakeup();
   return i;
 }
+
+// Which of POLLIN, POLLOUT and POLLHUP hold for the read end
+// of p, or the write end if writable.
+int
+pipepoll(struct pipe *p, int writable)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(writable){
+    if(!p->readopen)
+      r |= POLLHUP|POLLOUT;  // a write fails at once
+    else if(p->nwrite != p->nread + PIPESIZE && !p->wbusy)
+      r |= POLLOUT;
+  } else {
+    if(!p->writeopen)
+      r |= POLLHUP|POLLIN;   // a read returns at once
+    else if(p->nread != p->nwrite && !p->rbusy)
+      r |= POLLIN;
+  }
+  release(&p->lock);
+  return r;
+}
+
+//PAGEBREAK: 40
+// Splicing. The ring is filled or drained in place, without the
+// lock held, so that readi() and writei() can sleep; the busy
+// flags keep other readers or writers out meanwhile.
+
+// Wait for room in the ring and claim up to n bytes of it.
+// Sets *addr to the claimed space and returns its length, or
+// -1 if the read side is closed, or -EAGAIN if the ring is full
+// and nonblock. The caller fills it and calls pipewriteend().
+int
+pipewritebegin(struct pipe *p, char **addr, int n, int nonblock)
+{
+  uint m, room;
+
+  acquire(&p->lock);
+  while(p->nwrite == p->nread + PIPESIZE || p->wbusy){
+    if(p->readopen == 0 || myproc()->killed){
+      release(&p->lock);
+      return -1;
+    }
+    if(p->nrsleep)
+      wakeup(&p->nread);
+    if(nonblock){
+      release(&p->lock);
+      return -EAGAIN;
+    }
+    p->nwsleep++;
+    sleep(&p->nwrite, &p->lock);
+    p->nwsleep--;
+  }
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  *addr = pipeaddr(p, p->nwrite, &m);
+  room = p->nread + PIPESIZE - p->nwrite;
+  if(m > room)
+    m = room;
+  if(m > n)
+    m = n;
+  p->wbusy = 1;
+  release(&p->lock);
+  return m;
+}
+
+// Publish n bytes written to the space pipewritebegin() claimed.
+void
+pipewriteend(struct pipe *p, int n)
+{
+  acquire(&p->lock);
+  p->nwrite += n;
+  p->wbusy = 0;
+  if(p->nrsleep)
+    wakeup(&p->nread);
+  if(p->nwsleep)
+    wakeup(&p->nwrite);
+  release(&p->lock);
+  pollwakeup();
+}
+
+// Wait for data in the ring and claim up to n bytes of it.
+// Sets *addr to the claimed bytes and returns their number,
+// 0 at end of file, -1 if killed, or -EAGAIN if there are none
+// yet and nonblock. Unless it returns 0 or less, the caller
+// must pass the bytes it used to pipereadend().
+int
+pipereadbegin(struct pipe *p, char **addr, int n, int nonblock)
+{
+  uint m;
+
+  acquire(&p->lock);
+  while((p->nread == p->nwrite && p->writeopen) || p->rbusy){
+    if(myproc()->killed){
+      release(&p->lock);
+      return -1;
+    }
+    if(nonblock){
+      release(&p->lock);
+      return -EAGAIN;
+    }
+    p->nrsleep++;
+    sleep(&p->nread, &p->lock);
+    p->nrsleep--;
+  }
+  *addr = pipeaddr(p, p->nread, &m);
+  if(m > p->nwrite - p->nread)
+    m = p->nwrite - p->nread;
+  if(m > n)
+    m = n;
+  if(m > 0)
+    p->rbusy = 1;
+  release(&p->lock);
+  return m;
+}
+
+// Consume n of the bytes pipereadbegin() claimed.
+void
+pipereadend(struct pipe *p, int n)
+{
+  acquire(&p->lock);
+  p->nread += n;
+  p->rbusy = 0;
+  if(p->nwsleep)
+    wakeup(&p->nwrite);
+  if(p->nrsleep)
+    wakeup(&p->nread);
+  release(&p->lock);
+  pollwakeup();
+}
@@ -0,0 +1,127 @@
+// poll(): wait until one of several files is ready.
+//
+// A process can only sleep on one channel, so pollers all
+// sleep on pollq. Anything that can make a file ready (pipes,
+// the console) calls pollwakeup() after changing its state,
+// which costs a load and a branch unless someone is polling.
+// pollq.seq tells a poller whether a wakeup came between its
+// scan of the files and its going to sleep.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+
+struct {
+  struct spinlock lock;
+  int nsleep;  // processes in poll()
+  uint seq;    // number of pollwakeup()s with pollers present
+  uint due;    // earliest tick at which a poller times out
+} pollq;
+
+void
+pollinit(void)
+{
+  initlock(&pollq.lock, "pollq");
+  pollq.due = ~0;
+}
+
+// Tell pollers that some file's readiness may have changed.
+void
+pollwakeup(void)
+{
+  if(pollq.nsleep == 0)
+    return;
+  acquire(&pollq.lock);
+  pollq.seq++;
+  wakeup(&pollq);
+  release(&pollq.lock);
+}
+
+// Called on every clock tick to time pollers out.
+void
+polltick(void)
+{
+  if(pollq.nsleep == 0 || ticks < pollq.due)
+    return;
+  acquire(&pollq.lock);
+  pollq.due = ~0;
+  pollq.seq++;
+  wakeup(&pollq);
+  release(&pollq.lock);
+}
+
+// Which of the events in events f is ready for.
+static int
+filepoll(struct file *f, int events)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    r = pipepoll(f->pipe, f->writable);
+  else if(f->type == FD_INODE && f->ip->type == T_DEV &&
+          f->ip->major >= 0 && f->ip->major < NDEV && devsw[f->ip->major].poll)
+    r = devsw[f->ip->major].poll(f->ip);
+  else
+    r = POLLIN|POLLOUT;  // files never block
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r & (events|POLLHUP);
+}
+
+// Fill in revents for each of the n pollfds in fds, waiting up
+// to timeout ticks (forever if negative) for at least one to
+// be ready. Returns the number with events, 0 on timeout, or
+// -1 if killed.
+int
+poll(struct pollfd *fds, int n, int timeout)
+{
+  struct proc *curproc = myproc();
+  struct file *f;
+  uint seq, start;
+  int i, nready;
+
+  start = ticks;
+  acquire(&pollq.lock);
+  pollq.nsleep++;
+  for(;;){
+    seq = pollq.seq;
+    release(&pollq.lock);
+
+    nready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(fds[i].fd >= NOFILE || (f = curproc->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f, fds[i].events);
+      if(fds[i].revents)
+        nready++;
+    }
+
+    acquire(&pollq.lock);
+    if(nready > 0 || curproc->killed)
+      break;
+    if(timeout >= 0 && ticks - start >= timeout)
+      break;
+    if(pollq.seq != seq)
+      continue;  // something changed while we looked
+    if(timeout >= 0 && start + timeout < pollq.due)
+      pollq.due = start + timeout;
+    sleep(&pollq, &pollq.lock);
+  }
+  pollq.nsleep--;
+  release(&pollq.lock);
+  return curproc->killed && nready == 0 ? -1 : nready;
+}
@@ -0,0 +1,15 @@
+// Waiting on several file descriptors at once, for poll().
+// Both the kernel and user programs use this header file.
+
+struct pollfd {
+  int fd;         // File descriptor to watch, or -1 to skip
+  short events;   // Events to wait for
+  short revents;  // Events that happened
+};
+
+#define POLLIN   0x001  // data can be read without blocking
+#define POLLOUT  0x004  // data can be written without blocking
+#define POLLHUP  0x010  // the other end of a pipe is closed
+#define POLLNVAL 0x020  // fd is not an open file
+
+#define NPOLLFD 16  // most pollfds in one call
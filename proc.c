@@ -6,12 +6,20 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
 } ptable;
 
+// Serializes growproc(), so that threads sharing memory
+// cannot grow it at the same time.
+static struct spinlock growlock;
+
 // ctable will contain bits of data relevant to the 'root container'
 struct {
   struct container cont[NCONT];
@@ -37,6 +45,7 @@ void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  initlock(&growlock, "grow");
 }
 
 // Must be called with interrupts disabled
@@ -272,23 +281,115 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Number of processes other than p that use page table pgdir.
+// Caller must hold ptable.lock.
+static int
+vmusers(struct proc *p, pde_t *pgdir)
+{
+  struct proc *q;
+  int n;
+
+  n = 0;
+  for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+    if(q != p && q->state != UNUSED && q->pgdir == pgdir)
+      n++;
+  return n;
+}
+
+// Whether other threads share p's memory.
+int
+vmshared(struct proc *p)
+{
+  int n;
+
+  acquire(&ptable.lock);
+  n = vmusers(p, p->pgdir);
+  release(&ptable.lock);
+  return n > 0;
+}
+
+// Keep the other threads sharing p's page table from running,
+// and wait until none is, so that p may take pages away from
+// all of them: a CPU's TLB is flushed when it switches away
+// from a process. If another thread is doing the same, wait
+// for it to finish first. p must be the current process.
+void
+stopthreads(struct proc *p)
+{
+  struct proc *q;
+  int running;
+
+  acquire(&ptable.lock);
+  while(p->stopped){
+    release(&ptable.lock);
+    yield();  // not run again until startthreads()
+    acquire(&ptable.lock);
+  }
+  for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+    if(q != p && q->state != UNUSED && q->pgdir == p->pgdir)
+      q->stopped = 1;
+  for(;;){
+    running = 0;
+    for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+      if(q->stopped && q->pgdir == p->pgdir && q->state == RUNNING)
+        running = 1;
+    if(!running)
+      break;
+    release(&ptable.lock);
+    yield();
+    acquire(&ptable.lock);
+  }
+  release(&ptable.lock);
+}
+
+// Let the threads stopthreads(p) stopped run again.
+void
+startthreads(struct proc *p)
+{
+  struct proc *q;
+
+  acquire(&ptable.lock);
+  for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+    if(q != p && q->pgdir == p->pgdir)
+      q->stopped = 0;
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size on success, -1 on failure.
+// Threads share sz, so the new size is set in all of them.
+// Memory cannot shrink while it is shared, since other CPUs
+// may still have the freed pages in their TLBs.
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, oldsz;
   struct proc *curproc = myproc();
+  struct proc *p;
+  int shared;
 
-  sz = curproc->sz;
+  acquire(&growlock);
+  acquire(&ptable.lock);
+  shared = vmusers(curproc, curproc->pgdir);
+  release(&ptable.lock);
+  sz = oldsz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(&growlock);
       return -1;
+    }
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(shared || (sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(&growlock);
       return -1;
+    }
   }
-  curproc->sz = sz;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state != UNUSED && p->pgdir == curproc->pgdir)
+      p->sz = sz;
+  release(&ptable.lock);
+  release(&growlock);
   switchuvm(curproc);
 
   if (curproc->cont !=0) {
@@ -297,7 +398,7 @@ growproc(int n)
       kill_cont(curproc->cont->cid);
     }
   }
-  return 0;
+  return oldsz;
 }
 
 // Create a new process copying p as the parent.
@@ -325,6 +426,13 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+  if(vmsdup(curproc, np) < 0){
+    freeuvm(np->pgdir, np->vms);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->sz = curproc->sz;
   np->parent = curproc;
   np->cont = curproc->cont;
@@ -337,6 +445,7 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->cwdlower = curproc->cwdlower ? idup(curproc->cwdlower) : 0;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -351,6 +460,76 @@ fork(void)
   return pid;
 }
 
+// Create a thread: a process that shares the current process's
+// memory, and starts in fn(arg) on the one-page user stack at
+// stack. It gets copies of the open files, as fork() makes.
+// Returns the new thread's pid.
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+  uint sp, ustack[2];
+
+  if((uint)stack % PGSIZE != 0 || (uint)stack + PGSIZE > curproc->sz)
+    return -1;
+  // Threads must share one list of mappings.
+  if(vmsget(curproc) == 0)
+    return -1;
+
+  // Allocate process; it counts against the container's limit.
+  if((np = allocproc()) == 0){
+    if (curproc->cont != 0 && curproc->cont->tokill) {
+      kill_cont(curproc->cont->cid);
+    }
+    return -1;
+  }
+
+  // Share the address space and set up the new stack with arg
+  // and a return address that faults if fn returns.
+  ustack[0] = 0xffffffff;
+  ustack[1] = (uint)arg;
+  sp = (uint)stack + PGSIZE - sizeof(ustack);
+  if(vmfaultin(curproc, sp, sizeof(ustack), 1) < 0 ||
+     copyout(curproc->pgdir, sp, ustack, sizeof(ustack)) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->pgdir = curproc->pgdir;
+  np->vms = curproc->vms;
+  np->parent = curproc;
+  np->cont = curproc->cont;
+  np->thread = 1;
+  np->ustack = stack;
+  *np->tf = *curproc->tf;
+  np->tf->eip = (uint)fn;
+  np->tf->esp = sp;
+
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+  np->cwdlower = curproc->cwdlower ? idup(curproc->cwdlower) : 0;
+
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  pid = np->pid;
+
+  // sz is read under ptable.lock, which growproc() holds
+  // while it sets sz in all of a process's threads.
+  acquire(&ptable.lock);
+
+  np->sz = curproc->sz;
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
 int
 cfork(int cid)
 {
@@ -380,6 +559,13 @@ cfork(int cid)
     np->state = UNUSED;
     return -1;
   }
+  if(vmsdup(curproc, np) < 0){
+    freeuvm(np->pgdir, np->vms);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->sz = curproc->sz;
   np->parent = curproc;
   np->cont = ncont;
@@ -392,6 +578,7 @@ cfork(int cid)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->cwdlower = curproc->cwdlower ? idup(curproc->cwdlower) : 0;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -429,12 +616,26 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->cwdlower)
+    iput(curproc->cwdlower);
   end_op();
   curproc->cwd = 0;
+  curproc->cwdlower = 0;
 
   acquire(&ptable.lock);
 
-  // Parent might be sleeping in wait().
+  // A process takes its threads with it.
+  if(!curproc->thread){
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+      if(p != curproc && p->pgdir == curproc->pgdir && p->state != UNUSED){
+        p->killed = 1;
+        if(p->state == SLEEPING)
+          p->state = RUNNABLE;
+      }
+    }
+  }
+
+  // Parent might be sleeping in wait() or join().
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
@@ -452,44 +653,70 @@ exit(void)
   panic("zombie exit");
 }
 
+// Free zombie p. Caller must hold ptable.lock. Unless other
+// threads still use p's memory, it must be freed, with the
+// lock released, by passing *pgdir and *vms to freeuvm().
+static void
+reap(struct proc *p, pde_t **pgdir, struct vmspace **vms)
+{
+  struct container *cont = myproc()->cont;
+  int i;
+
+  if (cont != 0) {
+    for (i = 0 ; i < cont->total_proc ; i++) {
+      if (cont->inner_ptable[i] != 0 && cont->inner_ptable[i]->pid == p->pid) {
+        cont->inner_ptable[i] = 0;
+        break;
+      }
+    }
+  }
+  kfree(p->kstack);
+  p->kstack = 0;
+  *pgdir = 0;
+  *vms = 0;
+  if(vmusers(p, p->pgdir) == 0){
+    *pgdir = p->pgdir;
+    *vms = p->vms;
+  }
+  p->pgdir = 0;
+  p->vms = 0;
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->thread = 0;
+  p->ustack = 0;
+  p->stopped = 0;
+  p->state = UNUSED;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
+// Threads sharing this process's memory are left to join().
 int
 wait(void)
 {
   struct proc *p;
-  int havekids, pid, i;
+  int havekids, pid;
   struct proc *curproc = myproc();
-  struct container *cont = curproc->cont;
+  pde_t *pgdir;
+  struct vmspace *vms;
   
   acquire(&ptable.lock);
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+      if(p->parent != curproc || p->pgdir == curproc->pgdir)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        if (cont != 0) {
-          for (i = 0 ; i < curproc->cont->total_proc ; i++) {
-            if (cont->inner_ptable[i]->pid == pid) {
-              cont->inner_ptable[i] = 0;
-              break;
-            }
-          }
-        }
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        reap(p, &pgdir, &vms);
         release(&ptable.lock);
+        if(pgdir)
+          freeuvm(pgdir, vms);
         return pid;
       }
     }
@@ -505,6 +732,70 @@ wait(void)
   }
 }
 
+// Wait for a thread made by clone() to exit, store the stack
+// it was given in *stack, and return its pid.
+// Return -1 if this process has no threads.
+int
+join(void **stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  struct proc *curproc = myproc();
+  pde_t *pgdir;
+  struct vmspace *vms;
+
+  acquire(&ptable.lock);
+  for(;;){
+    havekids = 0;
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+      if(p->parent != curproc || p->pgdir != curproc->pgdir)
+        continue;
+      havekids = 1;
+      if(p->state == ZOMBIE){
+        pid = p->pid;
+        *stack = p->ustack;
+        reap(p, &pgdir, &vms);
+        release(&ptable.lock);
+        if(pgdir)
+          freeuvm(pgdir, vms);
+        return pid;
+      }
+    }
+    if(!havekids || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(curproc, &ptable.lock);
+  }
+}
+
+// Switch the current process from page table oldpgdir and
+// mappings oldvms, which exec() has replaced. Other threads
+// using them are killed, and they are freed when the last of
+// those is reaped.
+void
+vmrelease(pde_t *oldpgdir, struct vmspace *oldvms)
+{
+  struct proc *curproc = myproc();
+  struct proc *p;
+  int n;
+
+  acquire(&ptable.lock);
+  curproc->thread = 0;
+  n = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state != UNUSED && p->pgdir == oldpgdir){
+      p->killed = 1;
+      if(p->state == SLEEPING)
+        p->state = RUNNABLE;
+      n++;
+    }
+  }
+  release(&ptable.lock);
+  if(n == 0)
+    freeuvm(oldpgdir, oldvms);
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -527,7 +818,7 @@ scheduler(void)
     acquire(&ptable.lock);
 
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+      if(p->state != RUNNABLE || p->stopped)
         continue;
 
       // Switch to chosen process.  It is the process's job
@@ -600,6 +891,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -666,6 +958,26 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Wake up at most n processes sleeping on chan.
+// Returns the number woken.
+int
+wakeupn(void *chan, int n)
+{
+  struct proc *p;
+  int r;
+
+  r = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && r < n; p++){
+    if(p->state == SLEEPING && p->chan == chan){
+      p->state = RUNNABLE;
+      r++;
+    }
+  }
+  release(&ptable.lock);
+  return r;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -818,6 +1130,11 @@ cprocdump(void)
   release(&ptable.lock);
 }
 
+/*
+  Prints the memory use of the caller's container,
+  or of all of them in the root container.  Returns
+  the number of pages it has in swap space.
+*/
 int
 memdump(void)
 {
@@ -827,14 +1144,15 @@ memdump(void)
     // In root container, need to display all available and used memory 
     cprintf("Available memory in kilobytes: %d\n", total_mem * 4096);
     cprintf("Used memory in kilobytes: %d\n", used_mem * 4096);
+    return swapdump();
   } else {
     // In other container, only show available and used memory from within the container
     cprintf("Available memory in kilobytes: %d\n", cont->total_mem * 4096);
     cprintf("Used memory in kilobytes: %d\n", cont->used_mem * 4096);
-
+    cprintf("Swapped pages: %d, paged out %d, paged in %d\n",
+            cont->swapped, cont->pageouts, cont->pageins);
+    return cont->swapped;
   }
-
-  return -1;
 }
 
 void
@@ -869,13 +1187,13 @@ printdump(void)
 
 /* 
   Populates the ctable with a usable container struct
-  using a given virtual console, root directory, and
-  a start size for the filesystem.  If max proc mem or disk
+  using a given virtual console and root directory,
+  whose disk usage is charged to its quota record.  If max proc mem or disk
   is 0 then sets the default, otherwise sets the limits to the
   given values.
 */
 int
-spawn_cont(int vcnode, char *path, int used_disk, int max_proc, int max_mem, int max_disk)
+spawn_cont(int vcnode, char *path, int max_proc, int max_mem, int max_disk)
 {
   int i, cid;
   struct container *ncont;
@@ -915,16 +1233,32 @@ spawn_cont(int vcnode, char *path, int used_disk, int max_proc, int max_mem, int
     ncont->total_disk = 200000;
   } 
   ncont->vc_node = vcnode;
-  ncont->used_disk = used_disk;
   ncont->last_tick = 0;
   ncont->awake = 0;
   ncont->tokill = 0;
+  ncont->swapped = 0;
+  ncont->pageins = 0;
+  ncont->pageouts = 0;
 
-  if ((ip = namei(path)) == 0) {
+  // The disk usage of the container's tree is kept on disk
+  // in the quota record of its root directory.  Writes may go
+  // past 7/8 of total_disk for a grace period, never past it.
+  begin_op();
+  if ((ip = namei(path)) == 0 || (ncont->quota = qregister(ip)) < 0) {
+    if (ip != 0) {
+      iput(ip);
+    }
+    end_op();
+    ncont->cid = 0;
+    ncont->vc_node = 0;
     return -1;
   }
+  qsetlimit(ip->dev, ncont->quota, ncont->total_disk - ncont->total_disk / 8, ncont->total_disk);
+  end_op();
 
   ncont->root_dir = ip;
+  ncont->lower_dir = 0;
+  ncont->tmpdev = 0;
   strncpy(ncont->name, path, strlen(path));
 
   return cid;
@@ -980,6 +1314,36 @@ cresume(int cid)
   return 1;
 }
 
+/*
+  Pages out enough of the current process's
+  memory to bring its container back under
+  its memory limit, before the process returns
+  to user space.  Pages beyond the excess are
+  paged out too, so that this does not happen
+  on every return.  If nothing can be paged
+  out, the container is killed, as it was
+  before there was swap space.  When free
+  memory runs low, any process pages out a
+  batch, whatever its container.
+*/
+void
+cpageout(void)
+{
+  struct proc *curproc = myproc();
+  struct container *cont = curproc->cont;
+  int n;
+
+  if (cont != 0 && cont->cid != 0 && cont->used_mem > cont->total_mem) {
+    n = cont->used_mem - cont->total_mem + SWAPBATCH;
+    if (vmswapout(curproc, n) <= 0) {
+      cprintf("Container:%d exceeded memory limit\n", cont->cid);
+      kill_cont(cont->cid);
+    }
+  } else if (total_mem - used_mem < SWAPLOW) {
+    vmswapout(curproc, SWAPBATCH);
+  }
+}
+
 /*
   Resets the data of a container struct
   with the given cid.  Also kills all
@@ -989,6 +1353,7 @@ int
 kill_cont(int cid)
 {  
   struct container *cont;
+  struct inode *ip;
   cont = find_cont(cid);
 
   if (cont == 0) {
@@ -1003,13 +1368,89 @@ kill_cont(int cid)
 
   cont->cid = 0;
   cont->vc_node = 0;
-  cont->used_mem = 0;
-  cont->used_disk = 0;
+  kdisown(cont);
+  swapdisown(cont);
+  cont->quota = 0;
   cont->tokill = 0;
+  if (cont->lower_dir != 0) {
+    // Cleared first so the killed processes stop looking through it
+    ip = cont->lower_dir;
+    cont->lower_dir = 0;
+    begin_op();
+    iput(ip);
+    end_op();
+  }
+  if (cont->tmpdev != 0) {
+    // Freed once the killed processes let go of it
+    begin_op();
+    umount(cont->tmpdev, 1);
+    end_op();
+    tmpfsfree(cont->tmpdev);
+    cont->tmpdev = 0;
+  }
 
   return 0;
 }
 
+/*
+  Gives the container with the given cid the
+  directory ip as a shared read-only base under
+  its root directory.  Takes over the reference.
+*/
+int
+overlay_cont(int cid, struct inode *ip)
+{
+  struct container *cont;
+  cont = find_cont(cid);
+
+  if (cont == 0 || cont->lower_dir != 0) {
+    return -1;
+  }
+  cont->lower_dir = ip;
+  return 0;
+}
+
+/*
+  Mounts an empty tmpfs on the tmp directory
+  in the root of the container with the given cid.
+*/
+int
+tmpfs_cont(int cid)
+{
+  struct container *cont;
+  struct inode *mp;
+  int dev;
+  cont = find_cont(cid);
+
+  if (cont == 0 || cont->tmpdev != 0) {
+    return -1;
+  }
+  begin_op();
+  ilock(cont->root_dir);
+  mp = dirlookup(cont->root_dir, "tmp", 0);
+  iunlock(cont->root_dir);
+  if (mp == 0) {
+    end_op();
+    return -1;
+  }
+  ilock(mp);
+  if (mp->type != T_DIR || (dev = tmpfsalloc()) < 0) {
+    iunlockput(mp);
+    end_op();
+    return -1;
+  }
+  iunlock(mp);
+  if (mount(mp, dev) < 0) {
+    tmpfsfree(dev);
+    iput(mp);
+    end_op();
+    return -1;
+  }
+  end_op();
+  cont->tmpdev = dev;
+  return 0;
+}
+
 /*
   Prints the total and used disk space
   of a given container.
@@ -1027,7 +1468,7 @@ df_mem(void)
   } else {
     // In other container, only show available and used memory from within the container
     cprintf("Total disk space in kilobytes: %d\n", (cont->total_disk)/1024); 
-    cprintf("Used disk space in kilobytes: %d\n", (cont->used_disk)/1024);
+    cprintf("Used disk space in kilobytes: %d\n", qusage(cont->root_dir->dev, cont->quota)/1024);
   }
 
   return 1;
@@ -1077,9 +1518,11 @@ c_info(void)
       
       cprintf("Used memory: %d Available memory: %d \n", ctable.cont[i].used_mem, 
         ctable.cont[i].total_mem - ctable.cont[i].used_mem);
+      cprintf("Swapped pages: %d Paged out: %d Paged in: %d \n", ctable.cont[i].swapped,
+        ctable.cont[i].pageouts, ctable.cont[i].pageins);
 
-      cprintf("Used disk space: %d Available disk space: %d \n", ctable.cont[i].used_disk, 
-        ctable.cont[i].total_disk - ctable.cont[i].used_disk);
+      cprintf("Used disk space: %d Available disk space: %d \n", qusage(ctable.cont[i].root_dir->dev, ctable.cont[i].quota), 
+        ctable.cont[i].total_disk - qusage(ctable.cont[i].root_dir->dev, ctable.cont[i].quota));
 
       int k;
       for(k = 0; k < ctable.cont[i].total_proc; k++) {
@@ -54,10 +54,16 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *cwdlower;      // Lower layer of cwd in an overlay container
   char name[16];               // Process name (debugging)
   uint ticks;                  // Number of ticks process has been running
   struct container *cont;      // Pointer to process's container
   uint last_tick;              // Tick that it was on when called for scheduling
+  int thread;                  // Made by clone(): shares pgdir and sz with its parent
+  void *ustack;                // User stack passed to clone(), for join()
+  struct vmspace *vms;         // Mappings above the heap, or 0; shared by threads
+  uint swaphand;               // Where vmswapout() looks for a page next
+  int stopped;                 // Kept from running while a thread pages out (stopthreads)
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -74,17 +80,22 @@ struct container {
   int total_proc;                     // The total number of processes allowed
   int used_mem;                       // The amount of memory being used by the container
   int total_mem;                      // The total amount of memory allowed for the container
-  int used_disk;                      // The amount of disk space used by the container
+  int quota;                          // Slot of the quota record for root_dir
   int total_disk;                     // The total amount of disk space allowed for the container
   struct inode *root_dir;             // A pointer to the containers 'root' directory
+  struct inode *lower_dir;            // Shared read-only base under root_dir, or 0
+  int tmpdev;                         // Device of the tmpfs at /tmp, or 0
   char name[16];                      // The name of the containers 'root' directory
   uint ticks;                         // Number of ticks container has been running
   uint last_tick;                     // Tick that it was on when called for scheduling
   int awake;
   int tokill;
+  int swapped;                        // Pages of the container in swap space
+  uint pageins;                       // Pages read back in from swap space
+  uint pageouts;                      // Pages written out to swap space
 };
 
-int spawn_cont(int vcnode, char *path, int used_disk, int max_proc, int max_mem, int max_disk);
+int spawn_cont(int vcnode, char *path, int max_proc, int max_mem, int max_disk);
 void cprocdump(void);
 int memdump(void);
 void printdump(void);
@@ -98,6 +109,9 @@ int cresume(int cid);
 int cfork(int cid);
 int proc_print(struct proc*);
 int kill_cont(int cid);
+void cpageout(void);
+int overlay_cont(int cid, struct inode *ip);
+int tmpfs_cont(int cid);
 int df_mem(void);
 int total_used_disk(int used_disk);
 int c_info();
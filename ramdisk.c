@@ -0,0 +1,89 @@
+// RAM disks: block devices whose blocks live in kernel pages.
+// Pages are allocated the first time a block in them is
+// written; blocks never written read as zeroes, so a fresh
+// ramdisk is blank and gets formatted when first mounted.
+// Unmounting a ramdisk frees its pages, and it is blank again.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define BPP (PGSIZE/BSIZE)  // blocks per page
+
+struct ramdisk {
+  struct spinlock lock;
+  char *page[RAMSIZE/BPP];
+};
+
+static struct ramdisk ramdisk[NRAMDISK];
+
+// Sync buf with the ramdisk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+static void
+ramdiskrw(struct buf *b)
+{
+  struct ramdisk *rd;
+  char **pp;
+
+  if(!holdingsleep(&b->lock))
+    panic("ramdiskrw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("ramdiskrw: nothing to do");
+  if(b->blockno >= RAMSIZE)
+    panic("ramdiskrw: block out of range");
+
+  rd = &ramdisk[b->dev - RAMDEV];
+  acquire(&rd->lock);
+  pp = &rd->page[b->blockno/BPP];
+  if(b->flags & B_DIRTY){
+    if(*pp == 0 && (*pp = kalloc()) != 0)
+      memset(*pp, 0, PGSIZE);
+    if(*pp == 0)
+      panic("ramdiskrw: out of memory");
+    memmove(*pp + (b->blockno%BPP)*BSIZE, b->data, BSIZE);
+    b->flags &= ~B_DIRTY;
+  } else if(*pp == 0)
+    memset(b->data, 0, BSIZE);
+  else
+    memmove(b->data, *pp + (b->blockno%BPP)*BSIZE, BSIZE);
+  b->flags |= B_VALID;
+  release(&rd->lock);
+}
+
+// Free the pages of ramdisk dev, which has just been unmounted.
+static void
+ramdiskrelease(uint dev)
+{
+  struct ramdisk *rd;
+  int i;
+
+  binval(dev);
+  rd = &ramdisk[dev - RAMDEV];
+  acquire(&rd->lock);
+  for(i = 0; i < RAMSIZE/BPP; i++){
+    if(rd->page[i]){
+      kfree(rd->page[i]);
+      rd->page[i] = 0;
+    }
+  }
+  release(&rd->lock);
+}
+
+void
+ramdiskinit(void)
+{
+  int i;
+
+  for(i = 0; i < NRAMDISK; i++){
+    initlock(&ramdisk[i].lock, "ramdisk");
+    bdevsw[RAMDEV + i].rw = ramdiskrw;
+    bdevsw[RAMDEV + i].size = RAMSIZE;
+    bdevsw[RAMDEV + i].release = ramdiskrelease;
+  }
+}
@@ -0,0 +1,135 @@
+// Shared memory segments.
+//
+// A segment is a set of pages named by a key, which processes
+// in the same container attach to map the pages into their
+// address space (see vmmapshm in vm.c). Keys are per container:
+// processes in different containers never see each other's
+// segments. The segment holds one reference to each of its
+// pages and each mapping another, so a page is freed, and
+// credited to the container, once no one uses it. A segment
+// lasts until its last attachment goes away.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg {
+  int key;              // name of the segment; 0 if the slot is free
+  int cid;              // container whose key it is; 0 outside containers
+  int npages;           // number of pages
+  int nattach;          // number of mappings
+  char *page[SHMMAXPG];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+static int
+mycid(void)
+{
+  struct proc *p = myproc();
+
+  return p->cont ? p->cont->cid : 0;
+}
+
+// Add an attachment to segment id, as vmsdup() does.
+void
+shmhold(int id)
+{
+  acquire(&shmtable.lock);
+  shmtable.seg[id].nattach++;
+  release(&shmtable.lock);
+}
+
+// Drop an attachment to segment id, freeing it with the last.
+void
+shmrelease(int id)
+{
+  struct shmseg *s;
+  int i;
+
+  acquire(&shmtable.lock);
+  s = &shmtable.seg[id];
+  if(s->nattach < 1)
+    panic("shmrelease");
+  if(--s->nattach == 0){
+    for(i = 0; i < s->npages; i++)
+      kfree(s->page[i]);
+    s->key = 0;
+  }
+  release(&shmtable.lock);
+}
+
+// Attach the segment named key in the caller's container,
+// first creating it with size bytes, zero-filled, if there is
+// none. Returns the address it is mapped at, or -1.
+int
+shmat(int key, uint size)
+{
+  struct shmseg *s, *free;
+  int i, cid, npages;
+  uint addr;
+
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(key == 0 || npages < 1 || npages > SHMMAXPG)
+    return -1;
+  cid = mycid();
+
+  acquire(&shmtable.lock);
+  free = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->key == key && s->cid == cid)
+      break;
+    if(s->key == 0 && free == 0)
+      free = s;
+  }
+  if(s == &shmtable.seg[NSHM]){
+    // Create it, charged to the caller's container.
+    if((s = free) == 0){
+      release(&shmtable.lock);
+      return -1;
+    }
+    for(i = 0; i < npages; i++){
+      if((s->page[i] = kalloc()) == 0){
+        while(--i >= 0)
+          kfree(s->page[i]);
+        release(&shmtable.lock);
+        return -1;
+      }
+      memset(s->page[i], 0, PGSIZE);
+    }
+    s->key = key;
+    s->cid = cid;
+    s->npages = npages;
+    s->nattach = 0;
+  } else if(npages > s->npages){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->nattach++;  // keeps s while we map it
+  release(&shmtable.lock);
+
+  if((addr = vmmapshm(myproc(), s->page, s->npages, s - shmtable.seg)) == 0){
+    shmrelease(s - shmtable.seg);
+    return -1;
+  }
+  return addr;
+}
+
+// Detach the segment mapped at addr.
+int
+shmdt(uint addr)
+{
+  return vmunmap(myproc(), addr, 0);
+}
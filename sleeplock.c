@@ -16,6 +16,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
   lk->pid = 0;
 }
 
@@ -23,21 +25,45 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->wwait++;
+  while (lk->locked || lk->readers) {
     sleep(lk, &lk->lk);
   }
+  lk->wwait--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
+// Acquire lk in shared mode. Any number of readers may
+// hold it together, but not while a writer holds it or
+// is waiting for it.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwait) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+// Release lk, whichever mode it was acquired in.
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  lk->locked = 0;
-  lk->pid = 0;
-  wakeup(lk);
+  if(lk->locked){
+    lk->locked = 0;
+    lk->pid = 0;
+  } else if(lk->readers > 0){
+    lk->readers--;
+  } else {
+    panic("releasesleep");
+  }
+  if(lk->readers == 0)
+    wakeup(lk);
   release(&lk->lk);
 }
 
@@ -47,10 +73,7 @@ holdingsleep(struct sleeplock *lk)
   int r;
   
   acquire(&lk->lk);
-  r = lk->locked;
+  r = lk->locked || lk->readers;
   release(&lk->lk);
   return r;
 }
-
-
-
@@ -1,6 +1,9 @@
-// Long-term locks for processes
+// Long-term locks for processes.
+// Held either exclusively by one process or shared by readers.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of shared holders
+  int wwait;         // Writers waiting; they keep new readers out
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
@@ -9,3 +9,9 @@ struct stat {
   short nlink; // Number of links to file
   uint size;   // Size of file in bytes
 };
+
+// A directory entry as getdents() returns it.
+struct dirstat {
+  struct stat st;  // Only dev and ino unless stat was asked for
+  char name[16];   // Nul-terminated name, at most DIRSIZ bytes
+};
@@ -0,0 +1,223 @@
+// Swap space: where pages of user memory go while their
+// container is over its memory limit, or memory is short (see
+// vmswapout in vm.c and cpageout in proc.c).
+//
+// A page goes to the compressed pool in memory (zram.c) if it
+// can, and otherwise to the disk: mkfs sets aside SWAPSIZE
+// blocks after the file system on the root device, and each
+// run of PGSIZE/BSIZE of them is a slot that holds one page.
+// Slots from NSLOT up are the pool's. While a page is out,
+// its PTE holds the slot with PTE_S set and PTE_P clear, so
+// that using the page faults and vmfault() reads it back in.
+// A slot is charged to the container that was charged for its
+// page.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "x86.h"
+
+#define BPP    (PGSIZE/BSIZE)            // blocks per slot
+#define NSLOT  (SWAPSIZE/BPP)
+#define NZSLOT (ZRAMPAGES*PGSIZE/ZCHUNK)
+
+struct {
+  struct spinlock lock;
+  struct sleeplock io;         // held while a page is read back in
+  uint dev;
+  uint start;                  // first block of slot 0
+  int nslot;                   // 0 if there is no swap space on disk
+  char used[NSLOT];
+  struct container *owner[NSLOT+NZSLOT];
+  uint pageins;
+  uint pageouts;
+  uint zfaults;                // page-ins from the pool
+  uint zkcycles;               // thousands of cycles they took
+  uint dfaults;                // page-ins from the disk
+  uint dkcycles;
+} swap;
+
+// Find the swap space on dev. Must be called in process
+// context, since it reads the super block.
+void
+swapinit(uint dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.io, "swapio");
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / BPP;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+  zraminit();
+}
+
+// Move slot's blocks to or from page.
+static void
+swaprw(int slot, char *page, int write)
+{
+  int i;
+
+  for(i = 0; i < BPP; i++)
+    if(bdirect(swap.dev, swap.start + slot*BPP + i, page + i*BSIZE, write) < 0)
+      panic("swaprw");
+}
+
+// Write page to a free slot, in the pool if it compresses
+// and fits there, and return the slot, or -1 if swap space is
+// full. Freeing the page is up to the caller.
+int
+swapout(char *page)
+{
+  struct container *cont;
+  int slot, z;
+
+  if((z = zstore(page)) >= 0){
+    slot = NSLOT + z;
+    acquire(&swap.lock);
+  } else {
+    acquire(&swap.lock);
+    for(slot = 0; slot < swap.nslot; slot++)
+      if(!swap.used[slot])
+        break;
+    if(slot == swap.nslot){
+      release(&swap.lock);
+      return -1;
+    }
+    swap.used[slot] = 1;
+  }
+  cont = kowner(page);
+  swap.owner[slot] = cont;
+  swap.pageouts++;
+  if(cont){
+    cont->swapped++;
+    cont->pageouts++;
+  }
+  release(&swap.lock);
+
+  if(slot < NSLOT)
+    swaprw(slot, page, 1);
+  return slot;
+}
+
+// Copy the page in slot to page, leaving the slot in use,
+// as fork() does.
+void
+swapread(int slot, char *page)
+{
+  if(slot >= NSLOT)
+    zload(slot - NSLOT, page);
+  else
+    swaprw(slot, page, 0);
+}
+
+// Free slot, whose page is back in memory or gone.
+void
+swapfree(int slot)
+{
+  struct container *cont;
+
+  if(slot >= NSLOT)
+    zfree(slot - NSLOT);
+  acquire(&swap.lock);
+  if(slot < NSLOT){
+    if(slot < 0 || slot >= swap.nslot || !swap.used[slot])
+      panic("swapfree");
+    swap.used[slot] = 0;
+  }
+  if((cont = swap.owner[slot]) != 0)
+    cont->swapped--;
+  swap.owner[slot] = 0;
+  release(&swap.lock);
+}
+
+// Bring back the page whose PTE, *pte, says it is out.
+// Threads sharing the page table may fault on it at once;
+// the first reads it in and the rest find it present.
+// Returns 0, or -1 if out of memory.
+int
+swapin(pte_t *pte)
+{
+  struct container *cont;
+  char *mem;
+  int slot;
+  uint t0, kc;
+
+  t0 = rdtsc();
+  if((mem = kalloc()) == 0)
+    return -1;
+  acquiresleep(&swap.io);
+  if(!(*pte & PTE_S)){
+    releasesleep(&swap.io);
+    kfree(mem);
+    return 0;
+  }
+  slot = PTE_ADDR(*pte) / PGSIZE;
+  swapread(slot, mem);
+  // Accessed, so that the clock does not pick it right away.
+  *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_S) | PTE_P | PTE_A;
+  kc = (rdtsc() - t0) / 1000;
+  acquire(&swap.lock);
+  swap.pageins++;
+  if(slot >= NSLOT){
+    swap.zfaults++;
+    swap.zkcycles += kc;
+  } else {
+    swap.dfaults++;
+    swap.dkcycles += kc;
+  }
+  if((cont = swap.owner[slot]) != 0)
+    cont->pageins++;
+  release(&swap.lock);
+  swapfree(slot);
+  releasesleep(&swap.io);
+  return 0;
+}
+
+// Stop charging cont for slots, as it is being torn down.
+void
+swapdisown(struct container *cont)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < NSLOT+NZSLOT; i++)
+    if(swap.owner[i] == cont)
+      swap.owner[i] = 0;
+  cont->swapped = 0;
+  cont->pageins = 0;
+  cont->pageouts = 0;
+  release(&swap.lock);
+}
+
+// Print how much swap space is in use, how many pages have
+// gone out and come back in, and how long coming back in took
+// on average, from the pool and from the disk.
+// Returns the number of pages in swap space.
+int
+swapdump(void)
+{
+  int i, n;
+
+  acquire(&swap.lock);
+  n = 0;
+  for(i = 0; i < swap.nslot; i++)
+    if(swap.used[i])
+      n++;
+  cprintf("Swap: %d of %d disk pages used, %d paged out, %d paged in\n",
+          n, swap.nslot, swap.pageouts, swap.pageins);
+  cprintf("Page-in latency: %d kcycles from memory (%d faults), %d kcycles from disk (%d faults)\n",
+          swap.zfaults ? swap.zkcycles / swap.zfaults : 0, swap.zfaults,
+          swap.dfaults ? swap.dkcycles / swap.dfaults : 0, swap.dfaults);
+  release(&swap.lock);
+  return n + zdump();
+}
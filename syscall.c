@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "uio.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -13,13 +14,25 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Whether the n bytes at addr are the current process's:
+// below its size, or in one of its mappings above the heap,
+// which must be writable if the kernel is to write them.
+// Pages that have not been faulted in yet are brought in.
+static int
+useraddr(uint addr, uint n, int write)
+{
+  struct proc *curproc = myproc();
+
+  if(addr < curproc->sz && addr+n <= curproc->sz && addr+n >= addr)
+    return vmfaultin(curproc, addr, n, write) == 0;
+  return addr >= MMAPBASE && vmvalid(curproc, addr, n, write);
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
 {
-  struct proc *curproc = myproc();
-
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(!useraddr(addr, 4, 0))
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -39,6 +52,8 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && vmfaultin(curproc, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -59,20 +74,62 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || !useraddr(i, size, 1))
+    return -1;
+  *pp = (char*)i;
+  return 0;
+}
+
+// Like argptr, for a block the kernel only reads, which
+// may be in a read-only mapping.
+int
+argsrc(int n, char **pp, int size)
+{
+  int i;
+
+  if(argint(n, &i) < 0)
+    return -1;
+  if(size < 0 || !useraddr(i, size, 0))
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer to
+// cnt iovecs and copy them to iov, checking that every buffer
+// lies within the process address space, writably if write
+// is set. Returns the total length of the buffers.
+int
+argiov(int n, int cnt, struct iovec *iov, int write)
+{
+  struct iovec *uiov;
+  uint tot;
+  int i;
+
+  if(cnt < 0 || cnt > UIO_MAXIOV)
+    return -1;
+  if(argsrc(n, (char**)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    iov[i] = uiov[i];
+    if(!useraddr((uint)iov[i].iov_base, iov[i].iov_len, write))
+      return -1;
+    tot += iov[i].iov_len;
+    if((int)tot < 0)
+      return -1;
+  }
+  return tot;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Strings must lie below the process size, where no memory is
+// shared, so the string can't change between this check and
+// being used by the kernel.)
 int
 argstr(int n, char **pp)
 {
@@ -115,6 +172,33 @@ extern int sys_printstats(void);
 extern int sys_dfmem(void);
 extern int sys_tdiskused(void);
 extern int sys_cinfo(void);
+extern int sys_fcopy(void);
+extern int sys_reflink(void);
+extern int sys_coverlay(void);
+extern int sys_cregister(void);
+extern int sys_ctmpfs(void);
+extern int sys_mount(void);
+extern int sys_umount(void);
+extern int sys_lseek(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_fsync(void);
+extern int sys_fdatasync(void);
+extern int sys_getdents(void);
+extern int sys_splice(void);
+extern int sys_poll(void);
+extern int sys_fcntl(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_quota(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -150,6 +234,33 @@ static int (*syscalls[])(void) = {
 [SYS_dfmem] sys_dfmem,
 [SYS_tdiskused] sys_tdiskused,
 [SYS_cinfo] sys_cinfo,
+[SYS_fcopy] sys_fcopy,
+[SYS_reflink] sys_reflink,
+[SYS_coverlay] sys_coverlay,
+[SYS_cregister] sys_cregister,
+[SYS_ctmpfs] sys_ctmpfs,
+[SYS_mount] sys_mount,
+[SYS_umount] sys_umount,
+[SYS_lseek] sys_lseek,
+[SYS_pread] sys_pread,
+[SYS_pwrite] sys_pwrite,
+[SYS_readv] sys_readv,
+[SYS_writev] sys_writev,
+[SYS_fsync] sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_getdents] sys_getdents,
+[SYS_splice] sys_splice,
+[SYS_poll] sys_poll,
+[SYS_fcntl] sys_fcntl,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_clone] sys_clone,
+[SYS_join] sys_join,
+[SYS_shmat] sys_shmat,
+[SYS_shmdt] sys_shmdt,
+[SYS_mmap] sys_mmap,
+[SYS_munmap] sys_munmap,
+[SYS_quota] sys_quota,
 };
 
 void
@@ -32,5 +32,32 @@
 #define SYS_dfmem 31
 #define SYS_tdiskused 32
 #define SYS_cinfo 33
+#define SYS_fcopy 34
+#define SYS_reflink 35
+#define SYS_coverlay 36
+#define SYS_cregister 37
+#define SYS_ctmpfs 38
+#define SYS_mount 39
+#define SYS_umount 40
+#define SYS_lseek 41
+#define SYS_pread 42
+#define SYS_pwrite 43
+#define SYS_readv 44
+#define SYS_writev 45
+#define SYS_fsync 46
+#define SYS_fdatasync 47
+#define SYS_getdents 48
+#define SYS_splice 49
+#define SYS_poll 50
+#define SYS_fcntl 51
+#define SYS_futex_wait 52
+#define SYS_futex_wake 53
+#define SYS_clone 54
+#define SYS_join 55
+#define SYS_shmat 56
+#define SYS_shmdt 57
+#define SYS_mmap 58
+#define SYS_munmap 59
+#define SYS_quota 60
 
 
@@ -9,12 +9,16 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
+#include "memlayout.h"
 #include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "poll.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -35,6 +39,8 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
+static struct inode* create(char *path, short type, short major, short minor);
+
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
 static int
@@ -85,11 +91,227 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argsrc(1, &p, n) < 0)
     return -1;
   return filewrite(f, p, n);
 }
 
+// Make everything written so far durable. The log commits
+// data and metadata together, so fdatasync() is fsync().
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+int
+sys_fdatasync(void)
+{
+  return sys_fsync();
+}
+
+// Read up to n entries of a directory, with their inodes'
+// stat if withstat is set, in one call.
+int
+sys_getdents(void)
+{
+  struct file *f;
+  struct dirstat *ds;
+  int n, withstat;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argint(3, &withstat) < 0)
+    return -1;
+  // Keep n*sizeof(*ds) from overflowing past the check.
+  if(n < 0 || n > 0x7fffffff/sizeof(*ds) || argptr(1, (char**)&ds, n*sizeof(*ds)) < 0)
+    return -1;
+  return filegetdents(f, ds, n, withstat);
+}
+
+// Read into, or write from, several buffers in one call.
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[UIO_MAXIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, iov, 1) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[UIO_MAXIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, iov, 0) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+// Read and write at a given offset, leaving the
+// file's own offset for other users of it.
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argsrc(1, &p, n) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+int
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+// Copy n bytes between two open files inside the kernel.
+int
+sys_fcopy(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  return filecopy(in, out, n);
+}
+
+// Get or set a file's flags; see fcntl.h.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    return f->flags;
+  case F_SETFL:
+    f->flags = arg & (O_SYNC|O_DIRECT|O_NONBLOCK);
+    return 0;
+  }
+  return -1;
+}
+
+// Map len bytes of a file, from offset off, into memory, or
+// of zero-filled memory with MAP_ANON, which ignores fd and
+// off. The address hint is ignored. Shared mappings cannot be
+// written, since nothing would write their pages back, and
+// anonymous ones must be private; shmat() shares memory.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int hint, len, prot, flags, off;
+  uint addr;
+
+  if(argint(0, &hint) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || len > KERNBASE - MMAPBASE || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(!(prot & PROT_READ) || (prot & ~(PROT_READ|PROT_WRITE)))
+    return -1;
+  if(flags == (MAP_PRIVATE|MAP_ANON)){
+    if((addr = vmmap(myproc(), 0, 0, len, prot, MAP_PRIVATE)) == 0)
+      return -1;
+    return addr;
+  }
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(argfd(4, 0, &f) < 0)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE))
+    return -1;
+  if(f->type != FD_INODE || f->lower || !f->readable || f->ip->type != T_FILE)
+    return -1;
+  if((addr = vmmap(myproc(), f->ip, off, len, prot, flags)) == 0)
+    return -1;
+  return addr;
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return vmunmap(myproc(), addr, len);
+}
+
+// Wait for any of several files to be ready. The timeout is
+// in clock ticks; negative means forever.
+int
+sys_poll(void)
+{
+  struct pollfd fds[NPOLLFD], *ufds;
+  int i, n, timeout, r;
+
+  if(argint(1, &n) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  if(n < 0 || n > NPOLLFD || argptr(0, (char**)&ufds, n*sizeof(*ufds)) < 0)
+    return -1;
+  for(i = 0; i < n; i++)
+    fds[i] = ufds[i];
+  if((r = poll(fds, n, timeout)) >= 0)
+    for(i = 0; i < n; i++)
+      ufds[i].revents = fds[i].revents;
+  return r;
+}
+
+// Move data between a pipe and another file in the kernel.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 int
 sys_close(void)
 {
@@ -125,7 +347,8 @@ sys_link(void)
     return -1;
 
   begin_op();
-  if((ip = namei(old)) == 0){
+  // A link changes ip->nlink, so it must be in the upper layer.
+  if((ip = nameiov(old, 1, 0)) == 0){
     end_op();
     return -1;
   }
@@ -164,61 +387,148 @@ bad:
   return -1;
 }
 
+// Create the file new as a copy-on-write clone of old.
+// The two share data blocks until one of them writes.
+int
+sys_reflink(void)
+{
+  char *new, *old;
+  struct inode *ip, *np;
+  int r;
+
+  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+    return -1;
+
+  begin_op();
+  if((ip = namei(old)) == 0){
+    end_op();
+    return -1;
+  }
+  ilockshared(ip);
+  if(ip->type != T_FILE){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+
+  if((np = create(new, T_FILE, 0, 0)) == 0){
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  if(ip == np){
+    iunlockput(np);
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  // Take the two locks in address order, as filecopy() does.
+  if(ip < np){
+    iunlock(np);
+    ilockshared(ip);
+    ilock(np);
+  } else {
+    ilockshared(ip);
+  }
+  r = iclone(ip, np, 0, MAXFILE);
+  iunlockput(np);
+  iunlockput(ip);
+  end_op();
+  return r;
+}
+
 // Is the directory dp empty except for "." and ".." ?
+// In an overlay, dp (if any) is merged with the lower
+// directory lower (if any), whose entries dp may hide.
 static int
-isdirempty(struct inode *dp)
+isdirempty(struct inode *dp, struct inode *lower)
 {
-  int off;
+  int off, empty;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  for(off=2*sizeof(de); dp && off<dp->size; off+=sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && de.inum != WHITEOUT)
       return 0;
   }
-  return 1;
+  if(lower == 0)
+    return 1;
+
+  empty = 1;
+  ilockshared(lower);
+  for(off=2*sizeof(de); lower->type == T_DIR && off<lower->size; off+=sizeof(de)){
+    if(readi(lower, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("isdirempty: readi");
+    if(de.inum != 0 && (dp == 0 || !dirwhiteout(dp, de.name))){
+      empty = 0;
+      break;
+    }
+  }
+  iunlock(lower);
+  return empty;
 }
 
 //PAGEBREAK!
 int
 sys_unlink(void)
 {
-  struct inode *ip, *dp;
+  struct inode *ip, *dp, *lp, *lip;
   struct dirent de;
   char name[DIRSIZ], *path;
   uint off;
-  int size;
 
   if(argstr(0, &path) < 0)
     return -1;
 
   begin_op();
-  if((dp = nameiparent(path, name)) == 0){
+  if((dp = nameiparentov(path, name, &lp)) == 0){
     end_op();
     return -1;
   }
 
   ilock(dp);
+  lip = 0;
 
   // Cannot unlink "." or "..".
   if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
     goto bad;
 
-  if((ip = dirlookup(dp, name, &off)) == 0)
-    goto bad;
+  // In an overlay, a name the lower layer still has must
+  // be hidden with a whiteout rather than just removed.
+  if(lp != 0 && !dirwhiteout(dp, name)){
+    ilockshared(lp);
+    lip = dirlookup(lp, name, 0);
+    iunlock(lp);
+  }
+
+  if((ip = dirlookup(dp, name, &off)) == 0){
+    if(lip == 0 || !isdirempty(0, lip) || dirlink(dp, name, WHITEOUT) < 0)
+      goto bad;
+    iput(lip);
+    iput(lp);
+    iunlockput(dp);
+    end_op();
+    return 0;
+  }
   ilock(ip);
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ip->type == T_DIR && !isdirempty(ip, ip->major == OPAQUE ? 0 : lip)){
+    iunlockput(ip);
+    goto bad;
+  }
+  if(ip->mdev != 0){  // something is mounted on it
     iunlockput(ip);
     goto bad;
   }
-  size = ip->size;
-  cprintf("File size: %d\n", size);
-
   memset(&de, 0, sizeof(de));
+  if(lip){
+    de.inum = WHITEOUT;
+    strncpy(de.name, name, DIRSIZ);
+  }
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
   if(ip->type == T_DIR){
@@ -226,26 +536,25 @@ sys_unlink(void)
     iupdate(dp);
   }
   iunlockput(dp);
+  if(lip)
+    iput(lip);
+  if(lp)
+    iput(lp);
 
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
 
   end_op();
-  struct proc *curproc = myproc();
-  struct container *cont;
-
-  if (curproc != 0) {
-    if ((cont = curproc->cont) != 0) {
-      cont->used_disk -= size;
-    }
-  }
-  used_disk -= size;
 
   return 0;
 
 bad:
   iunlockput(dp);
+  if(lip)
+    iput(lip);
+  if(lp)
+    iput(lp);
   end_op();
   return -1;
 }
@@ -254,15 +563,33 @@ static struct inode*
 create(char *path, short type, short major, short minor)
 {
   uint off;
-  struct inode *ip, *dp;
+  struct inode *ip, *dp, *lp, *lip;
   char name[DIRSIZ];
 
-  if((dp = nameiparent(path, name)) == 0)
+  if((dp = nameiparentov(path, name, &lp)) == 0)
     return 0;
   ilock(dp);
 
-  if((ip = dirlookup(dp, name, &off)) != 0){
+  ip = dirlookup(dp, name, &off);
+  if(ip == 0 && lp != 0 && !dirwhiteout(dp, name)){
+    // The lower layer may have it; files are copied up to be opened.
+    ilockshared(lp);
+    lip = dirlookup(lp, name, 0);
+    iunlock(lp);
+    if(lip != 0){
+      if(type != T_FILE || (ip = copyup(dp, name, lip)) == 0){
+        iunlockput(dp);
+        iput(lip);
+        iput(lp);
+        return 0;
+      }
+      iput(lip);
+    }
+  }
+  if(ip != 0){
     iunlockput(dp);
+    if(lp)
+      iput(lp);
     ilock(ip);
     if(type == T_FILE && ip->type == T_FILE)
       return ip;
@@ -270,29 +597,54 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    // A tmpfs is out of inodes.
+    iunlockput(dp);
+    if(lp)
+      iput(lp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
   ip->minor = minor;
+  ip->owner = dp->owner;
+  // A new directory over a whiteout must not show the
+  // lower directory of the same name.
+  if(type == T_DIR && lp != 0)
+    ip->major = OPAQUE;
   ip->nlink = 1;
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+      goto bad;
   }
 
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto bad;
+
+  if(type == T_DIR){
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
+  if(lp)
+    iput(lp);
 
   return ip;
+
+bad:
+  // Out of quota or tmpfs space: nothing refers to ip yet, so let it go.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  if(lp)
+    iput(lp);
+  return 0;
 }
 
 int
@@ -301,13 +653,14 @@ sys_open(void)
   char *path;
   int fd, omode;
   struct file *f;
-  struct inode *ip;
+  struct inode *ip, *lower;
 
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
 
   begin_op();
 
+  lower = 0;
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
@@ -315,22 +668,31 @@ sys_open(void)
       return -1;
     }
   } else {
-    if((ip = namei(path)) == 0){
+    // In an overlay, files opened for writing are copied up.
+    if((ip = nameiov(path, omode & (O_WRONLY|O_RDWR), &lower)) == 0){
       end_op();
       return -1;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
+      if(lower)
+        iput(lower);
       end_op();
       return -1;
     }
+    if(ip->type != T_DIR && lower){
+      iput(lower);
+      lower = 0;
+    }
   }
 
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
     iunlockput(ip);
+    if(lower)
+      iput(lower);
     end_op();
     return -1;
   }
@@ -339,9 +701,11 @@ sys_open(void)
 
   f->type = FD_INODE;
   f->ip = ip;
+  f->lower = lower;
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->flags = omode & (O_SYNC|O_DIRECT|O_NONBLOCK);
   return fd;
 }
 
@@ -385,27 +749,123 @@ int
 sys_chdir(void)
 {
   char *path;
-  struct inode *ip;
+  struct inode *ip, *lower;
   struct proc *curproc = myproc();
   
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+  // The cwd of an overlay container is always in the upper
+  // layer, so relative lookups can start from both layers.
+  if(argstr(0, &path) < 0 || (ip = nameiov(path, 1, &lower)) == 0){
     end_op();
     return -1;
   }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
+    if(lower)
+      iput(lower);
     end_op();
     return -1;
   }
   iunlock(ip);
   iput(curproc->cwd);
+  if(curproc->cwdlower)
+    iput(curproc->cwdlower);
   end_op();
   curproc->cwd = ip;
+  curproc->cwdlower = lower;
+  return 0;
+}
+
+// Give container cid the directory path as a shared read-only
+// lower layer under its root directory.
+int
+sys_coverlay(void)
+{
+  char *path;
+  int cid;
+  struct inode *ip;
+
+  if(myproc()->cont != 0 || argint(0, &cid) < 0 || argstr(1, &path) < 0)
+    return -1;
+
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  if(overlay_cont(cid, ip) < 0){
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  end_op();
   return 0;
 }
 
+// Start charging the disk usage of the directory tree at
+// path to a quota record of its own; see qregister().
+int
+sys_cregister(void)
+{
+  char *path;
+  struct inode *ip;
+  int slot;
+
+  if(myproc()->cont != 0 || argstr(0, &path) < 0)
+    return -1;
+
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  slot = qregister(ip);
+  iput(ip);
+  end_op();
+  return slot;
+}
+
+// Set the hard limit, in bytes, of the quota record of the
+// directory tree at path, registering it if need be, unless
+// the limit is negative; 0 means none. Returns the bytes
+// charged to the record.
+int
+sys_quota(void)
+{
+  char *path;
+  struct inode *ip;
+  int slot, hard;
+  uint dev;
+
+  if(myproc()->cont != 0 || argstr(0, &path) < 0 || argint(1, &hard) < 0)
+    return -1;
+
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  if((slot = qregister(ip)) < 0){
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  dev = ip->dev;
+  if(hard >= 0)
+    qsetlimit(dev, slot, 0, hard);
+  iput(ip);
+  end_op();
+  return qusage(dev, slot);
+}
+
 int
 sys_exec(void)
 {
@@ -456,3 +916,69 @@ sys_pipe(void)
   return 0;
 }
 
+// Mount the file system on block device dev at directory path.
+// A blank ramdisk is formatted first.
+int
+sys_mount(void)
+{
+  char *path;
+  int dev;
+  struct inode *ip;
+
+  if(myproc()->cont != 0 || argstr(0, &path) < 0 || argint(1, &dev) < 0)
+    return -1;
+  if(dev <= 0 || dev >= NBDEV)
+    return -1;
+
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  if(mount(ip, dev) < 0){
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  end_op();
+  return 0;
+}
+
+// Unmount the file system whose root is at path.
+// Fails while any of its files is open or in use.
+int
+sys_umount(void)
+{
+  char *path;
+  struct inode *ip;
+  uint dev;
+
+  if(myproc()->cont != 0 || argstr(0, &path) < 0)
+    return -1;
+
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  dev = ip->dev;
+  if(ip->inum != ROOTINO || dev == ROOTDEV || ISTMPDEV(dev)){
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  iput(ip);
+  if(umount(dev, 0) < 0){
+    end_op();
+    return -1;
+  }
+  end_op();
+  return 0;
+}
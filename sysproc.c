@@ -52,6 +52,48 @@ int sys_getcid(void)
   return curproc->cont->cid;
 }
 
+int
+sys_clone(void)
+{
+  int fn, arg, stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(2, &stack) < 0)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, (void*)stack);
+}
+
+int
+sys_join(void)
+{
+  void **stack;
+
+  if(argptr(0, (char**)&stack, sizeof(*stack)) < 0)
+    return -1;
+  return join(stack);
+}
+
+// Attach the shared memory segment key, creating it with
+// size bytes if need be; returns its address.
+int
+sys_shmat(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmat(key, size);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
+
 int
 sys_sbrk(void)
 {
@@ -60,8 +102,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if((addr = growproc(n)) < 0)
     return -1;
   return addr;
 }
@@ -100,20 +141,42 @@ sys_uptime(void)
   return xticks;
 }
 
+// Sleep until futex_wake(addr), if *addr == val.
+int
+sys_futex_wait(void)
+{
+  int addr, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+// Wake up to n processes in futex_wait(addr).
+int
+sys_futex_wake(void)
+{
+  int addr, n;
+
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
 int
 sys_cstart(void)
 {
-  int vcnode, used_disk, proc, mem, max_disk;
+  int vcnode, proc, mem, max_disk;
   char *path;
 
-  if (argint(0, &vcnode) < 0 || argstr(1, &path) < 0 || argint(2, &used_disk) < 0) {
+  if (argint(0, &vcnode) < 0 || argstr(1, &path) < 0) {
     return -1;
   }
-  if (argint(3, &proc) < 0 || argint(4, &mem) < 0 || argint(5, &max_disk) < 0) {
+  if (argint(2, &proc) < 0 || argint(3, &mem) < 0 || argint(4, &max_disk) < 0) {
     return -1;
   }
 
-  return spawn_cont(vcnode, path, used_disk, proc, mem, max_disk);
+  return spawn_cont(vcnode, path, proc, mem, max_disk);
 }
 
 int
@@ -180,6 +243,21 @@ sys_cresume(void){
   return cresume(cid);
 }
 
+int
+sys_ctmpfs(void)
+{
+  int cid;
+
+  if (myproc()->cont != 0) {
+    return -1;
+  }
+
+  if (argint(0, &cid) < 0) {
+    return -1;
+  }
+  return tmpfs_cont(cid);
+}
+
 int
 sys_cfork(void)
 {
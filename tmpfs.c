@@ -0,0 +1,274 @@
+// Memory-backed file system for container scratch space.
+//
+// Each tmpfs instance is its own device (TMPDEV + i) with a fixed
+// table of inodes whose data lives in kernel pages, so its files
+// never go through the log or the disk. The inode cache and the
+// rest of fs.c treat it like any other device; fs.c calls the
+// functions here wherever it would read or write disk blocks.
+//
+// Pages come from kalloc(), so they are charged to the used_mem
+// of the container whose process wrote them.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// A tmpfs inode; the in-memory inode caches everything but
+// the pages, which are only used with the inode locked.
+struct tinode {
+  short type;
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char *page[NTMPPAGE];
+};
+
+struct tmpfs {
+  int used;           // Instance is mounted or being torn down
+  int dying;          // Free once none of its inodes is in use
+  struct tinode inode[NTMPINODE];
+};
+
+struct {
+  struct spinlock lock;
+  struct tmpfs fs[NTMPFS];
+} tmptable;
+
+void
+tmpfsinit(void)
+{
+  initlock(&tmptable.lock, "tmpfs");
+}
+
+static struct tinode*
+tinode(struct inode *ip)
+{
+  return &tmptable.fs[ip->dev - TMPDEV].inode[ip->inum];
+}
+
+// Free the pages of every inode of t.
+static void
+tmpfree(struct tmpfs *t)
+{
+  struct tinode *tp;
+  int i;
+
+  for(tp = t->inode; tp < t->inode + NTMPINODE; tp++){
+    for(i = 0; i < NTMPPAGE; i++)
+      if(tp->page[i])
+        kfree(tp->page[i]);
+    memset(tp, 0, sizeof(*tp));
+  }
+}
+
+// Create an empty tmpfs and return its device number, or -1.
+int
+tmpfsalloc(void)
+{
+  struct tmpfs *t;
+  struct tinode *root;
+  struct dirent *de;
+
+  acquire(&tmptable.lock);
+  for(t = tmptable.fs; t < tmptable.fs + NTMPFS; t++)
+    if(!t->used)
+      break;
+  if(t == tmptable.fs + NTMPFS){
+    release(&tmptable.lock);
+    return -1;
+  }
+  t->used = 1;
+  release(&tmptable.lock);
+
+  // The root directory holds "." and "..", both itself.
+  root = &t->inode[ROOTINO];
+  if((root->page[0] = kalloc()) == 0){
+    acquire(&tmptable.lock);
+    t->used = 0;
+    release(&tmptable.lock);
+    return -1;
+  }
+  memset(root->page[0], 0, PGSIZE);
+  root->type = T_DIR;
+  root->nlink = 1;
+  root->size = 2 * sizeof(*de);
+  de = (struct dirent*)root->page[0];
+  de[0].inum = ROOTINO;
+  safestrcpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = ROOTINO;
+  safestrcpy(de[1].name, "..", DIRSIZ);
+  return TMPDEV + (t - tmptable.fs);
+}
+
+// If tmpfs dev is dying and none of its inodes is in use any
+// more, free it. Whoever clears dying does the freeing, so
+// that two last iput()s cannot both free the pages.
+static void
+tmpreap(uint dev)
+{
+  struct tmpfs *t;
+
+  t = &tmptable.fs[dev - TMPDEV];
+  acquire(&tmptable.lock);
+  if(!t->dying || ipurge(dev) > 0){
+    release(&tmptable.lock);
+    return;
+  }
+  t->dying = 0;
+  release(&tmptable.lock);
+
+  tmpfree(t);
+  acquire(&tmptable.lock);
+  t->used = 0;
+  release(&tmptable.lock);
+}
+
+// Free tmpfs dev once no inode of it is in use; until then
+// tmprelease() tries again each time one is let go.
+void
+tmpfsfree(uint dev)
+{
+  acquire(&tmptable.lock);
+  tmptable.fs[dev - TMPDEV].dying = 1;
+  release(&tmptable.lock);
+  tmpreap(dev);
+}
+
+// Called by iput() when the last reference to an inode
+// of tmpfs dev goes away.
+void
+tmprelease(uint dev)
+{
+  tmpreap(dev);
+}
+
+// Allocate an inode of type type on tmpfs dev.
+// Returns its inode number, or 0 if there are none left.
+uint
+tmpialloc(uint dev, short type)
+{
+  struct tmpfs *t;
+  uint inum;
+
+  t = &tmptable.fs[dev - TMPDEV];
+  acquire(&tmptable.lock);
+  for(inum = ROOTINO + 1; inum < NTMPINODE; inum++){
+    if(t->inode[inum].type == 0){
+      memset(&t->inode[inum], 0, sizeof(t->inode[inum]));
+      t->inode[inum].type = type;
+      release(&tmptable.lock);
+      return inum;
+    }
+  }
+  release(&tmptable.lock);
+  return 0;
+}
+
+// Fill in ip from its tmpfs inode (cf. ilock).
+void
+tmpiload(struct inode *ip)
+{
+  struct tinode *tp;
+
+  tp = tinode(ip);
+  ip->type = tp->type;
+  ip->major = tp->major;
+  ip->minor = tp->minor;
+  ip->nlink = tp->nlink;
+  ip->size = tp->size;
+  ip->owner = 0;
+}
+
+// Copy ip back to its tmpfs inode (cf. iupdate).
+void
+tmpiupdate(struct inode *ip)
+{
+  struct tinode *tp;
+
+  tp = tinode(ip);
+  acquire(&tmptable.lock);  // tmpialloc() looks at type
+  tp->type = ip->type;
+  release(&tmptable.lock);
+  tp->major = ip->major;
+  tp->minor = ip->minor;
+  tp->nlink = ip->nlink;
+  tp->size = ip->size;
+}
+
+// Read from a tmpfs file; readi() has checked the range.
+int
+tmpread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct tinode *tp;
+  uint tot, m;
+
+  tp = tinode(ip);
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(dst, tp->page[off/PGSIZE] + off%PGSIZE, m);
+  }
+  return n;
+}
+
+// Write to a tmpfs file, allocating pages as needed.
+// Comes up short when the file is full or memory runs out.
+int
+tmpwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct tinode *tp;
+  uint tot, m;
+  char **pp;
+
+  tp = tinode(ip);
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    if(off/PGSIZE >= NTMPPAGE)
+      break;
+    pp = &tp->page[off/PGSIZE];
+    if(*pp == 0){
+      if((*pp = kalloc()) == 0)
+        break;
+      memset(*pp, 0, PGSIZE);
+    }
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(*pp + off%PGSIZE, src, m);
+  }
+  if(off > ip->size)
+    ip->size = tp->size = off;
+  if(tot == 0 && n > 0)
+    return -1;
+  return tot;
+}
+
+// Return the address of byte off of a tmpfs file,
+// which must be below its size.
+char*
+tmpdata(struct inode *ip, uint off)
+{
+  return tinode(ip)->page[off/PGSIZE] + off%PGSIZE;
+}
+
+// Discard the contents of a tmpfs file (cf. itrunc).
+void
+tmptrunc(struct inode *ip)
+{
+  struct tinode *tp;
+  int i;
+
+  tp = tinode(ip);
+  for(i = 0; i < NTMPPAGE; i++){
+    if(tp->page[i]){
+      kfree(tp->page[i]);
+      tp->page[i] = 0;
+    }
+  }
+  ip->size = tp->size = 0;
+}
@@ -44,6 +44,7 @@ trap(struct trapframe *tf)
     syscall();
     if(myproc()->killed)
       exit();
+    cpageout();
     return;
   }
 
@@ -54,6 +55,7 @@ trap(struct trapframe *tf)
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      polltick();
     }
     curproc = myproc();
     if (curproc != 0) {
@@ -86,6 +88,14 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A page of a mapping that is not there yet, or a write
+    // to a page a private mapping shares; see vmfault().
+    if(myproc() && (tf->cs&3) == DPL_USER &&
+       vmfault(myproc(), rcr2(), tf->err & FEC_WR) == 0)
+      break;
+    // Otherwise fall through.
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -108,6 +118,11 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
+  // Commit file system writes that have been deferred too long.
+  if(myproc() && (tf->cs&3) == DPL_USER &&
+     tf->trapno == T_IRQ0+IRQ_TIMER && log_due())
+    log_sync();
+
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
@@ -117,4 +132,8 @@ trap(struct trapframe *tf)
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
+
+  // Page out memory its container is over its limit by.
+  if(myproc() && (tf->cs&3) == DPL_USER)
+    cpageout();
 }
@@ -0,0 +1,9 @@
+// Scatter/gather I/O, for readv() and writev().
+// Both the kernel and user programs use this header file.
+
+struct iovec {
+  void *iov_base;  // Start of a buffer
+  uint iov_len;    // Its length in bytes
+};
+
+#define UIO_MAXIOV 16  // most iovecs in one call
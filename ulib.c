@@ -140,3 +140,49 @@ int itoa(int value, char *sp, int radix)
 
   return len;
 }
+
+// Take m, sleeping in the kernel while someone else holds it.
+void
+mutex_lock(struct mutex *m)
+{
+  if(xchg(&m->val, 1) == 0)
+    return;
+  // Mark it contended, so that the holder wakes us.
+  while(xchg(&m->val, 2) != 0)
+    futex_wait(&m->val, 2);
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(xchg(&m->val, 0) == 2)
+    futex_wake(&m->val, 1);
+}
+
+// Release m, wait for cond_signal() or cond_broadcast() on c,
+// and take m again. As usual, the caller must recheck its
+// condition in a loop.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
@@ -2,9 +2,16 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "mman.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
+// Blocks of MMAPMIN bytes or more get anonymous mappings of
+// their own instead, which free() gives back to the kernel;
+// the heap itself never shrinks.
+
+#define MMAPMIN  (8*4096)
+#define MMAPPED  ((Header*)1)  // s.ptr of a block that has a mapping
 
 typedef long Align;
 
@@ -20,9 +27,10 @@ typedef union header Header;
 
 static Header base;
 static Header *freep;
+static struct mutex heaplock;  // threads share the heap
 
-void
-free(void *ap)
+static void
+freeblock(void *ap)
 {
   Header *bp, *p;
 
@@ -56,12 +64,12 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  freeblock((void*)(hp + 1));
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+allocblock(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -81,6 +89,7 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
+      p->s.ptr = 0;
       return (void*)(p + 1);
     }
     if(p == freep)
@@ -88,3 +97,52 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// A block with a mapping of its own; s.size counts bytes.
+static void*
+mapblock(uint nbytes)
+{
+  Header *hp;
+  uint n;
+
+  n = nbytes + sizeof(Header);
+  if(n < nbytes)
+    return 0;
+  hp = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(hp == MAP_FAILED)
+    return 0;
+  hp->s.ptr = MMAPPED;
+  hp->s.size = n;
+  return (void*)(hp + 1);
+}
+
+void*
+malloc(uint nbytes)
+{
+  void *p;
+
+  if(nbytes >= MMAPMIN && (p = mapblock(nbytes)) != 0)
+    return p;
+  mutex_lock(&heaplock);
+  p = allocblock(nbytes);
+  mutex_unlock(&heaplock);
+  return p;
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+
+  bp = (Header*)ap - 1;
+  if(bp->s.ptr == MMAPPED){
+    if(munmap(bp, bp->s.size) == 0)
+      return;
+    // The kernel keeps mappings while threads share them;
+    // reuse the block as part of the heap instead.
+    bp->s.size /= sizeof(Header);
+  }
+  mutex_lock(&heaplock);
+  freeblock(ap);
+  mutex_unlock(&heaplock);
+}
@@ -0,0 +1,23 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc < 2){
+    printf(2, "Usage: umount dirs...\n");
+    exit();
+  }
+
+  for(i = 1; i < argc; i++){
+    if(umount(argv[i]) < 0){
+      printf(2, "umount: %s failed to unmount\n", argv[i]);
+      break;
+    }
+  }
+
+  exit();
+}
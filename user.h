@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct iovec;
+struct dirstat;
+struct pollfd;
 
 // system calls
 int fork(void);
@@ -24,7 +27,7 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int getcid(void);
-int cstart(int vcnode, char *path, int used_disk, int max_proc, int max_mem, int max_disk);
+int cstart(int vcnode, char *path, int max_proc, int max_mem, int max_disk);
 void writeprocs(void);
 int writemem(void);
 int cpause(int cid);
@@ -35,8 +38,46 @@ void printstats(void);
 int dfmem(void);
 int tdiskused(int used_disk);
 void cinfo(void);
+int fcopy(int, int, int);
+int reflink(char*, char*);
+int coverlay(int, char*);
+int cregister(char*);
+int quota(char*, int);
+int ctmpfs(int);
+int mount(char*, int);
+int umount(char*);
+int lseek(int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int fsync(int);
+int fdatasync(int);
+int getdents(int, struct dirstat*, int, int);
+int splice(int, int, int);
+int poll(struct pollfd*, int, int);
+int fcntl(int, int, int);
+int futex_wait(volatile uint*, uint);
+int futex_wake(volatile uint*, int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+void* shmat(int, int);
+int shmdt(void*);
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
 
 
+// Locks built on futexes, which work across processes that
+// share the memory they are in. Zero-filled means unlocked
+// and not signalled.
+struct mutex {
+  volatile uint val;  // 0 unlocked, 1 locked, 2 locked with waiters
+};
+
+struct cond {
+  volatile uint seq;  // bumped by every signal
+};
+
 // ulib.c
 int stat(char*, struct stat*);
 char* strcpy(char*, char*);
@@ -50,4 +91,11 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
-int itoa(int, char*, int);
\ No newline at end of file
+int itoa(int, char*, int);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
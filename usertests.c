@@ -4,6 +4,9 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "poll.h"
+#include "mman.h"
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
@@ -1737,6 +1740,1515 @@ void argptest()
   printf(1, "arg test passed\n");
 }
 
+// fcopy() copies between files without a user buffer.
+void
+fcopytest(void)
+{
+  int fd0, fd1, i, n, total;
+
+  printf(1, "fcopy test\n");
+
+  fd0 = open("fcopy0", O_CREATE|O_RDWR);
+  if(fd0 < 0){
+    printf(1, "error: creat fcopy0 failed!\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a' + i, 1000);
+    if(write(fd0, buf, 1000) != 1000){
+      printf(1, "error: write fcopy0 failed\n");
+      exit();
+    }
+  }
+  close(fd0);
+
+  fd0 = open("fcopy0", O_RDONLY);
+  fd1 = open("fcopy1", O_CREATE|O_RDWR);
+  if(fd0 < 0 || fd1 < 0){
+    printf(1, "error: open fcopy failed\n");
+    exit();
+  }
+  total = 0;
+  while((n = fcopy(fd0, fd1, 3000)) > 0)
+    total += n;
+  if(n < 0 || total != 20000){
+    printf(1, "error: fcopy copied %d\n", total);
+    exit();
+  }
+  if(fcopy(fd0, fd0, 10) >= 0){
+    printf(1, "error: fcopy to itself succeeded\n");
+    exit();
+  }
+  close(fd0);
+  close(fd1);
+
+  fd1 = open("fcopy1", O_RDONLY);
+  for(i = 0; i < 20; i++){
+    if(read(fd1, buf, 1000) != 1000){
+      printf(1, "error: read fcopy1 failed\n");
+      exit();
+    }
+    for(n = 0; n < 1000; n++){
+      if(buf[n] != 'a' + i){
+        printf(1, "error: fcopy1 has wrong content\n");
+        exit();
+      }
+    }
+  }
+  close(fd1);
+  unlink("fcopy0");
+  unlink("fcopy1");
+  printf(1, "fcopy test ok\n");
+}
+
+// A reflink() clone reads like its source, and writing
+// either one leaves the other alone.
+void
+reflinktest(void)
+{
+  int fd, i;
+
+  printf(1, "reflink test\n");
+
+  fd = open("rlink0", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "error: creat rlink0 failed!\n");
+    exit();
+  }
+  for(i = 0; i < 30; i++){
+    memset(buf, 'a' + i % 26, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "error: write rlink0 failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  if(reflink("rlink0", "rlink1") < 0){
+    printf(1, "error: reflink failed\n");
+    exit();
+  }
+  if(reflink("rlink0", "rlink1") >= 0){
+    printf(1, "error: reflink over a non-empty file succeeded\n");
+    exit();
+  }
+
+  // Overwrite a direct and an indirect block of the clone.
+  fd = open("rlink1", O_RDWR);
+  memset(buf, 'X', 1024);
+  if(write(fd, buf, 1024) != 1024){
+    printf(1, "error: write rlink1 failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("rlink0", O_RDONLY);
+  for(i = 0; i < 30; i++){
+    if(read(fd, buf, 512) != 512 || buf[0] != 'a' + i % 26 || buf[511] != 'a' + i % 26){
+      printf(1, "error: rlink0 changed by a write to its clone\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("rlink1", O_RDONLY);
+  for(i = 0; i < 30; i++){
+    if(read(fd, buf, 512) != 512){
+      printf(1, "error: read rlink1 failed\n");
+      exit();
+    }
+    if(buf[0] != (i < 2 ? 'X' : 'a' + i % 26)){
+      printf(1, "error: rlink1 has wrong content\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  // Freeing the source must not free blocks the clone still uses.
+  unlink("rlink0");
+  fd = open("rlink1", O_RDONLY);
+  if(read(fd, buf, 512) != 512 || buf[0] != 'X'){
+    printf(1, "error: rlink1 lost data\n");
+    exit();
+  }
+  close(fd);
+  unlink("rlink1");
+  printf(1, "reflink test ok\n");
+}
+
+// A quota counts a block that a clone shares with its source
+// once: the clone costs nothing until it writes, and then only
+// the blocks it writes. The record that paid for a shared block
+// is the one refunded, even if the source goes first.
+void
+reflinkquotatest(void)
+{
+  int fd, i, u0, u1, u, ux, uy;
+
+  printf(1, "reflink quota test\n");
+
+  if(mkdir("rlq") < 0 || (u0 = quota("rlq", -1)) < 0){
+    printf(1, "error: quota on rlq failed\n");
+    exit();
+  }
+  fd = open("rlq/a", O_CREATE|O_RDWR);
+  memset(buf, 'q', 512);
+  for(i = 0; i < 8; i++){
+    if(write(fd, buf, 512) != 512){
+      printf(1, "error: write rlq/a failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  if((u1 = quota("rlq", -1)) != u0 + 8*512){
+    printf(1, "error: 8 blocks charged as %d bytes\n", u1 - u0);
+    exit();
+  }
+
+  if(reflink("rlq/a", "rlq/b") < 0){
+    printf(1, "error: reflink rlq/a failed\n");
+    exit();
+  }
+  if((u = quota("rlq", -1)) != u1){
+    printf(1, "error: unwritten clone charged %d bytes\n", u - u1);
+    exit();
+  }
+  fd = open("rlq/b", O_RDWR);
+  if(write(fd, buf, 512) != 512){
+    printf(1, "error: write rlq/b failed\n");
+    exit();
+  }
+  close(fd);
+  if((u = quota("rlq", -1)) != u1 + 512){
+    printf(1, "error: clone charged %d bytes for one written block\n", u - u1);
+    exit();
+  }
+
+  unlink("rlq/a");
+  unlink("rlq/b");
+  if((u = quota("rlq", -1)) != u0){
+    printf(1, "error: %d bytes still charged after unlink\n", u - u0);
+    exit();
+  }
+
+  if(mkdir("rlq/x") < 0 || mkdir("rlq/y") < 0 ||
+     (ux = quota("rlq/x", -1)) < 0 || (uy = quota("rlq/y", -1)) < 0){
+    printf(1, "error: quota on rlq/x, rlq/y failed\n");
+    exit();
+  }
+  fd = open("rlq/x/a", O_CREATE|O_RDWR);
+  for(i = 0; i < 8; i++){
+    if(write(fd, buf, 512) != 512){
+      printf(1, "error: write rlq/x/a failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  if(reflink("rlq/x/a", "rlq/y/b") < 0 || unlink("rlq/x/a") < 0){
+    printf(1, "error: reflink rlq/x/a failed\n");
+    exit();
+  }
+  if(quota("rlq/x", -1) != ux + 8*512 || quota("rlq/y", -1) != uy){
+    printf(1, "error: shared blocks moved to the clone's record\n");
+    exit();
+  }
+  unlink("rlq/y/b");
+  if(quota("rlq/x", -1) != ux || quota("rlq/y", -1) != uy){
+    printf(1, "error: shared blocks refunded to the wrong record\n");
+    exit();
+  }
+  if(unlink("rlq/x") < 0 || unlink("rlq/y") < 0 || unlink("rlq") < 0){
+    printf(1, "error: unlink rlq failed\n");
+    exit();
+  }
+  printf(1, "reflink quota test ok\n");
+}
+
+// A tree registered after it was written is charged for what is
+// already in it, and writing into it past the hard limit comes up
+// short and then fails, rather than killing anything.
+void
+quotafilltest(void)
+{
+  int fd, u, n;
+
+  printf(1, "quota fill test\n");
+
+  if(mkdir("qfill") < 0){
+    printf(1, "error: mkdir qfill failed\n");
+    exit();
+  }
+  fd = open("qfill/old", O_CREATE|O_RDWR);
+  memset(buf, 'o', 1024);
+  if(fd < 0 || write(fd, buf, 1024) != 1024){
+    printf(1, "error: write qfill/old failed\n");
+    exit();
+  }
+  close(fd);
+  // One block for the directory, two for qfill/old.
+  if((u = quota("qfill", -1)) != 3*512){
+    printf(1, "error: existing tree charged %d bytes\n", u);
+    exit();
+  }
+  if(quota("qfill", u + 4*512) != u){
+    printf(1, "error: quota limit on qfill failed\n");
+    exit();
+  }
+
+  fd = open("qfill/old", O_RDWR);
+  lseek(fd, 0, SEEK_END);
+  memset(buf, 'n', 8*512);
+  if((n = write(fd, buf, 8*512)) != 4*512){
+    printf(1, "error: write past the quota wrote %d bytes\n", n);
+    exit();
+  }
+  if(write(fd, buf, 512) != -1){
+    printf(1, "error: write with no quota left succeeded\n");
+    exit();
+  }
+  close(fd);
+  fd = open("qfill/new", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, 1) != -1){
+    printf(1, "error: write of a new file with no quota left succeeded\n");
+    exit();
+  }
+  close(fd);
+
+  if(unlink("qfill/old") < 0 || unlink("qfill/new") < 0 || quota("qfill", -1) != 512){
+    printf(1, "error: unlink did not refund qfill\n");
+    exit();
+  }
+  if(unlink("qfill") < 0){
+    printf(1, "error: unlink qfill failed\n");
+    exit();
+  }
+  printf(1, "quota fill test ok\n");
+}
+
+// Check that block i of the 20-block file fd holds 'a'+i, except
+// block 0, which holds c0.
+static int
+ovlcheck(int fd, char c0)
+{
+  int i, j;
+
+  for(i = 0; i < 20; i++){
+    if(read(fd, buf, 512) != 512)
+      return -1;
+    for(j = 0; j < 512; j++)
+      if(buf[j] != (i == 0 ? c0 : 'a' + i))
+        return -1;
+  }
+  return 0;
+}
+
+// A container over a base directory: writing a base file copies
+// it up, in several transactions since it has 20 blocks, and
+// removing one leaves a whiteout; the base itself never changes.
+void
+overlaytest(void)
+{
+  int cid, fd, i, pid;
+
+  printf(1, "overlay test\n");
+
+  if(mkdir("ovl") < 0 || mkdir("ovl/lower") < 0 || mkdir("ovl/upper") < 0){
+    printf(1, "error: mkdir ovl failed\n");
+    exit();
+  }
+  fd = open("ovl/lower/f", O_CREATE|O_RDWR);
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a' + i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "error: write ovl/lower/f failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  close(open("ovl/lower/g", O_CREATE|O_RDWR));
+
+  if((cid = cstart(96, "ovl/upper", 0, 0, 0)) < 0 || coverlay(cid, "ovl/lower") < 0){
+    printf(1, "error: cstart ovl failed\n");
+    exit();
+  }
+  if((pid = cfork(cid)) < 0){
+    printf(1, "error: cfork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    fd = open("/f", O_RDONLY);
+    if(fd < 0 || ovlcheck(fd, 'a') < 0){
+      printf(1, "error: /f does not show the base file\n");
+      exit();
+    }
+    close(fd);
+    fd = open("/f", O_RDWR);
+    memset(buf, 'X', 512);
+    if(fd < 0 || write(fd, buf, 512) != 512){
+      printf(1, "error: write /f failed\n");
+      exit();
+    }
+    close(fd);
+    fd = open("/f", O_RDONLY);
+    if(fd < 0 || ovlcheck(fd, 'X') < 0){
+      printf(1, "error: /f lost its contents in copy-up\n");
+      exit();
+    }
+    close(fd);
+    if(unlink("/g") < 0 || open("/g", O_RDONLY) >= 0){
+      printf(1, "error: unlink /g did not hide it\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+
+  fd = open("ovl/lower/f", O_RDONLY);
+  if(fd < 0 || ovlcheck(fd, 'a') < 0){
+    printf(1, "error: copy-up changed the base file\n");
+    exit();
+  }
+  close(fd);
+  fd = open("ovl/upper/f", O_RDONLY);
+  if(fd < 0 || ovlcheck(fd, 'X') < 0){
+    printf(1, "error: ovl/upper/f is not the copied-up file\n");
+    exit();
+  }
+  close(fd);
+  if((fd = open("ovl/lower/g", O_RDONLY)) < 0){
+    printf(1, "error: unlink /g removed it from the base\n");
+    exit();
+  }
+  close(fd);
+  if(open("ovl/upper/g", O_RDONLY) >= 0){
+    printf(1, "error: whiteout ovl/upper/g opens\n");
+    exit();
+  }
+
+  cstop(cid);
+  if(unlink("ovl/upper/f") < 0 || unlink("ovl/lower/f") < 0 || unlink("ovl/lower/g") < 0){
+    printf(1, "error: unlink ovl files failed\n");
+    exit();
+  }
+  if(unlink("ovl/lower") < 0 || unlink("ovl/upper") < 0 || unlink("ovl") < 0){
+    printf(1, "error: unlink ovl failed\n");
+    exit();
+  }
+  printf(1, "overlay test ok\n");
+}
+
+// A container's tmpfs: files on it live in memory, on a device
+// of their own, and outlive its unmount while still open. It is
+// freed when the last of them is closed, and a new one is empty.
+void
+tmpfstest(void)
+{
+  int cid, fd, fd2;
+  struct stat st, dst;
+
+  printf(1, "tmpfs test\n");
+
+  if(mkdir("tmpfsd") < 0 || mkdir("tmpfsd/tmp") < 0){
+    printf(1, "error: mkdir tmpfsd failed\n");
+    exit();
+  }
+  if((cid = cstart(97, "tmpfsd", 0, 0, 0)) < 0 || ctmpfs(cid) < 0){
+    printf(1, "error: ctmpfs failed\n");
+    exit();
+  }
+  fd = open("tmpfsd/tmp/f", O_CREATE|O_RDWR);
+  memset(buf, 't', 512);
+  if(fd < 0 || write(fd, buf, 512) != 512){
+    printf(1, "error: write tmpfsd/tmp/f failed\n");
+    exit();
+  }
+  close(fd);
+  if(stat(".", &dst) < 0 || stat("tmpfsd/tmp/f", &st) < 0 || st.dev == dst.dev){
+    printf(1, "error: tmpfsd/tmp/f is not on the tmpfs\n");
+    exit();
+  }
+
+  fd2 = open("tmpfsd/tmp/f", O_RDONLY);
+  if(fd2 < 0){
+    printf(1, "error: open tmpfsd/tmp/f failed\n");
+    exit();
+  }
+  cstop(cid);
+  if(open("tmpfsd/tmp/f", O_RDONLY) >= 0){
+    printf(1, "error: tmpfs still mounted after cstop\n");
+    exit();
+  }
+  memset(buf, 0, 512);
+  if(read(fd2, buf, 512) != 512 || buf[0] != 't' || buf[511] != 't'){
+    printf(1, "error: open tmpfs file lost its contents\n");
+    exit();
+  }
+  close(fd2);
+
+  if((cid = cstart(97, "tmpfsd", 0, 0, 0)) < 0 || ctmpfs(cid) < 0){
+    printf(1, "error: ctmpfs after cstop failed\n");
+    exit();
+  }
+  if(open("tmpfsd/tmp/f", O_RDONLY) >= 0){
+    printf(1, "error: new tmpfs is not empty\n");
+    exit();
+  }
+  cstop(cid);
+  if(unlink("tmpfsd/tmp") < 0 || unlink("tmpfsd") < 0){
+    printf(1, "error: unlink tmpfsd failed\n");
+    exit();
+  }
+  printf(1, "tmpfs test ok\n");
+}
+
+// Mount a ramdisk, use it, and unmount it: a directory mounted on
+// shows the ramdisk's file system, and unmounting the ramdisk
+// frees its pages, so the next mount finds it blank.
+void
+ramdisktest(void)
+{
+  int fd, i;
+  struct stat st;
+
+  printf(1, "ramdisk test\n");
+
+  if(mkdir("rdmnt") < 0 || mount("rdmnt", RAMDEV) < 0){
+    printf(1, "error: mount ramdisk failed\n");
+    exit();
+  }
+  fd = open("rdmnt/f", O_CREATE|O_RDWR);
+  memset(buf, 'r', 512);
+  for(i = 0; i < 16; i++){
+    if(fd < 0 || write(fd, buf, 512) != 512){
+      printf(1, "error: write rdmnt/f failed\n");
+      exit();
+    }
+  }
+  if(fstat(fd, &st) < 0 || st.dev != RAMDEV){
+    printf(1, "error: rdmnt/f is not on the ramdisk\n");
+    exit();
+  }
+  if(umount("rdmnt") >= 0){
+    printf(1, "error: umount of a ramdisk in use succeeded\n");
+    exit();
+  }
+  close(fd);
+  if(umount("rdmnt") < 0){
+    printf(1, "error: umount ramdisk failed\n");
+    exit();
+  }
+  if(open("rdmnt/f", O_RDONLY) >= 0){
+    printf(1, "error: rdmnt/f still there after umount\n");
+    exit();
+  }
+
+  if(mount("rdmnt", RAMDEV) < 0){
+    printf(1, "error: mount ramdisk again failed\n");
+    exit();
+  }
+  if(open("rdmnt/f", O_RDONLY) >= 0){
+    printf(1, "error: ramdisk kept its contents across umount\n");
+    exit();
+  }
+  if(umount("rdmnt") < 0 || unlink("rdmnt") < 0){
+    printf(1, "error: umount ramdisk failed\n");
+    exit();
+  }
+  printf(1, "ramdisk test ok\n");
+}
+
+#define SWAPLIMIT 64   // pages the swap test's container may use
+#define SWAPPAGES 160  // pages it touches
+
+// Word j of page i in pass pass of swaptest: even pages are
+// all one word and go to the compressed pool, odd ones do not
+// compress and go to the disk.
+static uint
+swapword(int i, int j, int pass)
+{
+  if(i % 2 == 0)
+    return i + pass;
+  return (i*4099 + j + pass) * 2654435761U;
+}
+
+static uint *swapmem;
+static volatile int swapbad;
+
+// Go over pages lo up to hi of swapmem, checking for what pass
+// pass-1 wrote and writing the words of pass.
+static void
+swapsweep(int lo, int hi, int pass)
+{
+  int i, j;
+
+  for(i = lo; i < hi; i++){
+    for(j = 0; j < 1024; j++){
+      if(pass > 0 && swapmem[i*1024 + j] != swapword(i, j, pass - 1)){
+        printf(1, "error: page %d came back in wrong\n", i);
+        swapbad = 1;
+        return;
+      }
+      swapmem[i*1024 + j] = swapword(i, j, pass);
+    }
+  }
+}
+
+// Two passes over half of swapmem, run by a thread.
+static void
+swapthread(void *arg)
+{
+  int lo;
+
+  lo = (int)arg * SWAPPAGES/2;
+  swapsweep(lo, lo + SWAPPAGES/2, 0);
+  swapsweep(lo, lo + SWAPPAGES/2, 1);
+}
+
+// A container that goes past its memory limit is paged, not
+// killed, even if its process has threads: its pages come back
+// in with what was written to them, and its swap space is given
+// back when the process exits.
+void
+swaptest(void)
+{
+  int cid, pid, i;
+
+  printf(1, "swap test\n");
+
+  if(mkdir("swapd") < 0 || (cid = cstart(98, "swapd", 0, SWAPLIMIT, 0)) < 0){
+    printf(1, "error: cstart swapd failed\n");
+    exit();
+  }
+  if((pid = cfork(cid)) < 0){
+    printf(1, "error: cfork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if((pid = fork()) < 0){
+      printf(1, "error: fork in container failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if((swapmem = (uint*)sbrk(SWAPPAGES*4096)) == (uint*)-1){
+        printf(1, "error: sbrk past the memory limit failed\n");
+        exit();
+      }
+      for(i = 0; i < 2; i++){
+        if(thread_create(swapthread, (void*)i) < 0){
+          printf(1, "error: thread_create failed\n");
+          exit();
+        }
+      }
+      for(i = 0; i < 2; i++)
+        thread_join();
+      swapsweep(0, SWAPPAGES, 2);
+      if(swapbad)
+        exit();
+      if(writemem() <= 0){
+        printf(1, "error: nothing was paged out\n");
+        exit();
+      }
+      exit();
+    }
+    wait();
+    if(writemem() != 0){
+      printf(1, "error: swap space not given back on exit\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+
+  cstop(cid);
+  if(unlink("swapd") < 0){
+    printf(1, "error: unlink swapd failed\n");
+    exit();
+  }
+  printf(1, "swap test ok\n");
+}
+
+// lseek, and pread/pwrite, which leave the file offset alone.
+void
+seektest(void)
+{
+  int fd, i;
+
+  printf(1, "seek test\n");
+
+  fd = open("seekf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "error: creat seekf failed!\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    memset(buf, '0' + i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "error: write seekf failed\n");
+      exit();
+    }
+  }
+  if(lseek(fd, 0, SEEK_CUR) != 2048 || lseek(fd, 0, SEEK_END) != 2048){
+    printf(1, "error: lseek reports the wrong offset\n");
+    exit();
+  }
+  if(lseek(fd, 1, SEEK_END) >= 0 || lseek(fd, -1, SEEK_SET) >= 0){
+    printf(1, "error: lseek outside the file succeeded\n");
+    exit();
+  }
+  if(lseek(fd, 1024, SEEK_SET) != 1024 || read(fd, buf, 1) != 1 || buf[0] != '2'){
+    printf(1, "error: read after lseek failed\n");
+    exit();
+  }
+
+  if(pread(fd, buf, 512, 512) != 512 || buf[0] != '1' || buf[511] != '1'){
+    printf(1, "error: pread failed\n");
+    exit();
+  }
+  memset(buf, 'p', 10);
+  if(pwrite(fd, buf, 10, 2044) != 10){
+    printf(1, "error: pwrite failed\n");
+    exit();
+  }
+  if(lseek(fd, 0, SEEK_CUR) != 1025){
+    printf(1, "error: pread/pwrite moved the offset\n");
+    exit();
+  }
+  if(lseek(fd, 0, SEEK_END) != 2054 || pread(fd, buf, 20, 2040) != 14 ||
+     buf[3] != '3' || buf[4] != 'p' || buf[13] != 'p'){
+    printf(1, "error: pwrite wrote the wrong place\n");
+    exit();
+  }
+  close(fd);
+  unlink("seekf");
+  printf(1, "seek test ok\n");
+}
+
+// getdents returns every live entry once, in batches, with
+// the same stat that stat() would give.
+void
+dentstest(void)
+{
+  struct dirstat ds[5];
+  struct stat st;
+  char name[2];
+  int fd, i, n, seen, found;
+
+  printf(1, "getdents test\n");
+
+  if(mkdir("dentsd") < 0){
+    printf(1, "error: mkdir dentsd failed\n");
+    exit();
+  }
+  chdir("dentsd");
+  name[1] = 0;
+  for(i = 0; i < 12; i++){
+    name[0] = 'a' + i;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "error: create in dentsd failed\n");
+      exit();
+    }
+    write(fd, buf, i*10);
+    close(fd);
+  }
+  unlink("c");
+
+  if((fd = open(".", 0)) < 0){
+    printf(1, "error: open dentsd failed\n");
+    exit();
+  }
+  seen = found = 0;
+  while((n = getdents(fd, ds, 5, 1)) > 0){
+    for(i = 0; i < n; i++){
+      seen++;
+      if(stat(ds[i].name, &st) < 0 || st.ino != ds[i].st.ino ||
+         st.type != ds[i].st.type || st.size != ds[i].st.size){
+        printf(1, "error: getdents stat of %s differs\n", ds[i].name);
+        exit();
+      }
+      if(ds[i].name[1] == 0 && ds[i].name[0] >= 'a' && ds[i].name[0] <= 'l')
+        found++;
+    }
+  }
+  if(n < 0 || seen != 13 || found != 11){
+    printf(1, "error: getdents saw %d entries, %d files\n", seen, found);
+    exit();
+  }
+  close(fd);
+
+  if((fd = open("a", 0)) < 0 || getdents(fd, ds, 5, 0) >= 0){
+    printf(1, "error: getdents on a file succeeded\n");
+    exit();
+  }
+  close(fd);
+  // A count whose size in bytes wraps must not pass as small.
+  fd = open(".", 0);
+  if(getdents(fd, ds, 0xffffffff/sizeof(ds[0]) + 1, 0) >= 0){
+    printf(1, "error: getdents with a huge count succeeded\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < 12; i++){
+    name[0] = 'a' + i;
+    unlink(name);
+  }
+  chdir("..");
+  if(unlink("dentsd") < 0){
+    printf(1, "error: unlink dentsd failed\n");
+    exit();
+  }
+  printf(1, "getdents test ok\n");
+}
+
+// splice moves file data through a pipe and back out intact.
+void
+splicetest(void)
+{
+  int fds[2], fd, fd1, i, n, pid;
+
+  printf(1, "splice test\n");
+
+  fd = open("splicef", O_CREATE|O_RDWR);
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i%23;
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "error: write splicef failed\n");
+    exit();
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splicef", O_RDONLY);
+    if(splice(fd, fd, 10) >= 0){
+      printf(1, "error: splice without a pipe succeeded\n");
+      exit();
+    }
+    while((n = splice(fd, fds[1], 3000)) > 0)
+      ;
+    if(n < 0)
+      printf(1, "error: splice into pipe failed\n");
+    exit();
+  }
+  close(fds[1]);
+  fd1 = open("splicef1", O_CREATE|O_RDWR);
+  for(i = 0; (n = splice(fds[0], fd1, 5000)) > 0; i += n)
+    ;
+  close(fds[0]);
+  wait();
+  close(fd1);
+  if(n < 0 || i != sizeof(buf)){
+    printf(1, "error: spliced %d bytes out of pipe\n", i);
+    exit();
+  }
+  fd1 = open("splicef1", O_RDONLY);
+  memset(buf, 0, sizeof(buf));
+  if(read(fd1, buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "error: read splicef1 failed\n");
+    exit();
+  }
+  close(fd1);
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != 'a' + i%23){
+      printf(1, "error: splicef1 has wrong data at %d\n", i);
+      exit();
+    }
+  }
+  unlink("splicef");
+  unlink("splicef1");
+  printf(1, "splice test ok\n");
+}
+
+// poll waits on two pipes at once, times out, and reports
+// closed pipes and bad descriptors.
+void
+polltest(void)
+{
+  struct pollfd pfd[3];
+  int a[2], b[2], pid, start;
+
+  printf(1, "poll test\n");
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = -1;
+  start = uptime();
+  if(poll(pfd, 3, 0) != 0 || poll(pfd, 3, 3) != 0 || uptime() - start < 3){
+    printf(1, "error: poll on empty pipes did not time out\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    sleep(5);
+    write(b[1], "x", 1);
+    exit();
+  }
+  if(poll(pfd, 3, -1) != 1 || pfd[0].revents != 0 || pfd[1].revents != POLLIN){
+    printf(1, "error: poll missed a write\n");
+    exit();
+  }
+  wait();
+
+  pfd[0].fd = a[1];
+  pfd[0].events = POLLOUT;
+  close(b[1]);
+  close(a[0]);
+  if(poll(pfd, 2, -1) != 2 || pfd[0].revents != (POLLOUT|POLLHUP) ||
+     pfd[1].revents != (POLLIN|POLLHUP)){
+    printf(1, "error: poll missed a close\n");
+    exit();
+  }
+  close(a[1]);
+  close(b[0]);
+  pfd[0].fd = b[0];
+  if(poll(pfd, 1, 0) != 1 || pfd[0].revents != POLLNVAL){
+    printf(1, "error: poll on a closed fd\n");
+    exit();
+  }
+  printf(1, "poll test ok\n");
+}
+
+// O_NONBLOCK pipe ends fail with EAGAIN instead of sleeping,
+// splicing included.
+void
+nonblocktest(void)
+{
+  int fds[2], fd, n, tot;
+
+  printf(1, "nonblock test\n");
+
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(fds[0], F_GETFL, 0) != O_NONBLOCK ||
+     fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0){
+    printf(1, "error: fcntl failed\n");
+    exit();
+  }
+  if(read(fds[0], buf, 1) != -EAGAIN){
+    printf(1, "error: read of an empty pipe did not fail with EAGAIN\n");
+    exit();
+  }
+  fd = open("nonblockf", O_CREATE|O_RDWR);
+  if(fd < 0 || splice(fds[0], fd, 10) != -EAGAIN){
+    printf(1, "error: splice from an empty pipe did not fail with EAGAIN\n");
+    exit();
+  }
+  for(tot = 0; (n = write(fds[1], buf, sizeof(buf))) > 0; tot += n)
+    ;
+  if(n != -EAGAIN || tot == 0){
+    printf(1, "error: write to a full pipe returned %d\n", n);
+    exit();
+  }
+  if(splice(fd, fds[1], 10) != -EAGAIN || splice(fds[0], fds[1], 10) != -1){
+    printf(1, "error: splice into a full pipe, or itself, did not fail\n");
+    exit();
+  }
+  close(fd);
+  unlink("nonblockf");
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    tot -= n;
+  if(n != -EAGAIN || tot != 0){
+    printf(1, "error: nonblocking reads lost data\n");
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, 1) != 0){
+    printf(1, "error: read of a closed pipe did not return 0\n");
+    exit();
+  }
+  close(fds[0]);
+  printf(1, "nonblock test ok\n");
+}
+
+// futex_wait only sleeps while the word holds the given value.
+void
+futextest(void)
+{
+  static volatile uint word;
+  static struct mutex m;
+
+  printf(1, "futex test\n");
+
+  word = 1;
+  if(futex_wait(&word, 0) != -EAGAIN){
+    printf(1, "error: futex_wait on a changed word slept\n");
+    exit();
+  }
+  if(futex_wake(&word, 1) != 0 || futex_wait((uint*)0x7ffffffc, 0) != -1 ||
+     futex_wake((uint*)((uint)&word + 1), 1) != -1){
+    printf(1, "error: futex_wake of nothing, or a bad address\n");
+    exit();
+  }
+  mutex_lock(&m);
+  if(m.val != 1){
+    printf(1, "error: mutex not held\n");
+    exit();
+  }
+  mutex_unlock(&m);
+  if(m.val != 0){
+    printf(1, "error: mutex still held\n");
+    exit();
+  }
+  printf(1, "futex test ok\n");
+}
+
+// Threads share memory: they count under a mutex, hand off
+// through a condition variable, and see each other's sbrk().
+struct mutex tlock;
+struct cond tcond;
+volatile int tcount, tturn;
+char *volatile tbrk;
+
+void
+threadcount(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&tlock);
+    tcount++;
+    mutex_unlock(&tlock);
+  }
+  // Take turns in the order given by arg.
+  mutex_lock(&tlock);
+  while(tturn != (int)arg)
+    cond_wait(&tcond, &tlock);
+  tturn++;
+  cond_broadcast(&tcond);
+  mutex_unlock(&tlock);
+  if((int)arg == 0)
+    tbrk = sbrk(4096);
+}
+
+void
+threadtest(void)
+{
+  int i, pid;
+
+  printf(1, "thread test\n");
+
+  for(i = 0; i < 4; i++){
+    if(thread_create(threadcount, (void*)i) < 0){
+      printf(1, "error: thread_create failed\n");
+      exit();
+    }
+  }
+  pid = fork();
+  if(pid == 0)
+    exit();
+  if(wait() != pid){
+    printf(1, "error: wait returned a thread\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    if(thread_join() < 0){
+      printf(1, "error: thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1 || tcount != 4000 || tturn != 4){
+    printf(1, "error: threads counted %d, took %d turns\n", tcount, tturn);
+    exit();
+  }
+  tbrk[4095] = 1;  // the thread's sbrk() grew our memory too
+  printf(1, "thread test ok\n");
+}
+
+// Processes see each other's writes to a shared segment, both
+// when attaching by key and when inheriting it through fork,
+// and can block on a futex in it.
+void
+shmtest(void)
+{
+  volatile uint *a, *b;
+  int pid;
+
+  printf(1, "shm test\n");
+
+  if((a = shmat(77, 8192)) == (uint*)-1 || a[0] != 0){
+    printf(1, "error: shmat failed\n");
+    exit();
+  }
+  a[0] = 1;
+  a[2000] = 2;
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // Both the inherited mapping and a new one.
+    b = shmat(77, 100);
+    if(b == (uint*)-1 || b == a || b[0] != 1 || b[2000] != 2)
+      printf(1, "error: child does not see the segment\n");
+    b[1] = 3;
+    while(a[0] == 1)
+      futex_wait(&a[0], 1);
+    a[3] = 4;
+    exit();
+  }
+  while(a[1] != 3)
+    sleep(1);
+  a[0] = 0;
+  futex_wake(&a[0], 1);
+  wait();
+  if(a[3] != 4){
+    printf(1, "error: parent does not see the child's writes\n");
+    exit();
+  }
+  if(shmat(77, 3*4096) != (void*)-1 || shmdt((void*)a) != 0 || shmdt((void*)a) != -1){
+    printf(1, "error: shmat or shmdt misbehaved\n");
+    exit();
+  }
+  if((a = shmat(77, 4096)) == (uint*)-1 || a[0] != 0 || a[3] != 0 || shmdt((void*)a) != 0){
+    printf(1, "error: a detached segment was not freed\n");
+    exit();
+  }
+  printf(1, "shm test ok\n");
+}
+
+// mmap shares a file's pages, keeps private writes private,
+// and sees writes made to the file through write() in shared
+// mappings only: a private mapping keeps the pages it has.
+void
+mmaptest(void)
+{
+  char *a, *b;
+  int fd, i, pid;
+
+  printf(1, "mmap test\n");
+
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "error: creat mmapf failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 23;
+  for(i = 0; i < 3; i++)
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "error: write mmapf failed\n");
+      exit();
+    }
+
+  a = mmap(0, 3*sizeof(buf), PROT_READ, MAP_SHARED, fd, 0);
+  b = mmap(0, 100, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 2*4096);
+  if(a == MAP_FAILED || b == MAP_FAILED){
+    printf(1, "error: mmap failed\n");
+    exit();
+  }
+  if(mmap(0, 100, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED ||
+     mmap(0, 100, PROT_READ, MAP_SHARED, fd, 1) != MAP_FAILED){
+    printf(1, "error: bad mmap succeeded\n");
+    exit();
+  }
+  for(i = 0; i < 3*sizeof(buf); i++)
+    if(a[i] != 'a' + i % sizeof(buf) % 23){
+      printf(1, "error: wrong data mapped at %d\n", i);
+      exit();
+    }
+  if(b[0] != a[2*4096]){
+    printf(1, "error: wrong data in private mapping\n");
+    exit();
+  }
+
+  // Writes to the file show through shared mappings but not
+  // private ones; private writes do not reach the file or
+  // other mappings.
+  if(pwrite(fd, "XY", 2, 2*4096) != 2 || a[2*4096] != 'X'){
+    printf(1, "error: mapping does not see write\n");
+    exit();
+  }
+  if(b[1] != 'a' + (2*4096+1) % sizeof(buf) % 23){
+    printf(1, "error: private mapping sees write\n");
+    exit();
+  }
+  b[0] = 'Z';
+  if(a[2*4096] != 'X' || pread(fd, buf, 1, 2*4096) != 1 || buf[0] != 'X'){
+    printf(1, "error: private write leaked\n");
+    exit();
+  }
+
+  // The kernel reads from and writes into mappings.
+  if(read(fd, b + 10, 5) != 0 || pread(fd, b + 10, 5, 0) != 5 || b[10] != 'a'){
+    printf(1, "error: read into mapping failed\n");
+    exit();
+  }
+  if(pwrite(fd, a + 1, 3, 10) != 3){
+    printf(1, "error: write from mapping failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(b[0] != 'Z' || a[2*4096+1] != 'Y')
+      printf(1, "error: child does not see mappings\n");
+    b[0] = 'W';
+    exit();
+  }
+  wait();
+  if(b[0] != 'Z'){
+    printf(1, "error: child's private write leaked\n");
+    exit();
+  }
+
+  if(munmap(a, 3*sizeof(buf)) != 0 || munmap(b, 100) != 0 || munmap(b, 100) != -1){
+    printf(1, "error: munmap misbehaved\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapf");
+  printf(1, "mmap test ok\n");
+}
+
+// Anonymous mappings are zero-filled, private across fork,
+// can be unmapped in part, and give their memory back: more
+// than all of physical memory goes through malloc and free.
+void
+anontest(void)
+{
+  char *a, *b;
+  int i, pid;
+
+  printf(1, "anon test\n");
+
+  a = mmap(0, 4*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(a == MAP_FAILED || a[0] != 0 || a[4*4096-1] != 0){
+    printf(1, "error: anonymous mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++)
+    a[i*4096] = 'a' + i;
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(a[3*4096] != 'd')
+      printf(1, "error: child does not see anonymous memory\n");
+    a[0] = 'x';
+    exit();
+  }
+  wait();
+  if(a[0] != 'a'){
+    printf(1, "error: child's write leaked\n");
+    exit();
+  }
+
+  // Punch a hole, then trim the ends.
+  if(munmap(a + 4096, 4096) != 0 || a[0] != 'a' || a[2*4096] != 'c' ||
+     munmap(a + 4096, 4096) != -1 || munmap(a, 4096) != 0 ||
+     munmap(a + 3*4096, 4096) != 0 || a[2*4096] != 'c' ||
+     munmap(a + 2*4096, 4096) != 0 || munmap(a, 4*4096) != -1){
+    printf(1, "error: partial munmap misbehaved\n");
+    exit();
+  }
+
+  for(i = 0; i < 64; i++){
+    if((b = malloc(4*1024*1024)) == 0){
+      printf(1, "error: malloc %d failed; memory was not freed\n", i);
+      exit();
+    }
+    for(a = b; a < b + 4*1024*1024; a += 4096)
+      *a = 1;
+    free(b);
+  }
+  printf(1, "anon test ok\n");
+}
+
+// Program text comes from the page cache and is read-only:
+// the kernel will not read() into it, writing it kills the
+// writer, and a forked child still runs from it.
+void
+texttest(void)
+{
+  int fd, pid;
+
+  printf(1, "text test\n");
+
+  fd = open("textf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf(1, "error: creat textf failed\n");
+    exit();
+  }
+  if(pread(fd, (char*)texttest, 1, 0) != -1){
+    printf(1, "error: read into text succeeded\n");
+    exit();
+  }
+  close(fd);
+  unlink("textf");
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    *(volatile char*)texttest = 0;
+    printf(1, "error: text is writable\n");
+    exit();
+  }
+  if(wait() != pid){
+    printf(1, "error: wait failed\n");
+    exit();
+  }
+  printf(1, "text test ok\n");
+}
+
+// writev/readv gather and scatter in order, files and pipes.
+void
+iovtest(void)
+{
+  struct iovec iov[3];
+  char a[5], b[11], c[7];
+  int fd, fds[2];
+
+  printf(1, "iov test\n");
+
+  iov[0].iov_base = "abc";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "defghij";
+  iov[2].iov_len = 7;
+  fd = open("iovf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "error: creat iovf failed!\n");
+    exit();
+  }
+  if(writev(fd, iov, 3) != 10){
+    printf(1, "error: writev failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("iovf", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = 4;
+  iov[1].iov_base = b;
+  iov[1].iov_len = 10;
+  memset(b, 0, sizeof(b));
+  if(readv(fd, iov, 2) != 10){
+    printf(1, "error: readv failed\n");
+    exit();
+  }
+  a[4] = 0;
+  if(strcmp(a, "abcd") != 0 || strcmp(b, "efghij") != 0){
+    printf(1, "error: readv read the wrong data\n");
+    exit();
+  }
+  if(readv(fd, iov, 2) != 0){
+    printf(1, "error: readv past the end\n");
+    exit();
+  }
+  close(fd);
+  unlink("iovf");
+
+  if(pipe(fds) != 0){
+    printf(1, "error: pipe() failed\n");
+    exit();
+  }
+  iov[0].iov_base = "xy";
+  iov[0].iov_len = 2;
+  iov[1].iov_base = "zzzz";
+  iov[1].iov_len = 4;
+  if(writev(fds[1], iov, 2) != 6){
+    printf(1, "error: writev to a pipe failed\n");
+    exit();
+  }
+  if(read(fds[0], c, 6) != 6 || (c[6] = 0, strcmp(c, "xyzzzz")) != 0){
+    printf(1, "error: pipe got the wrong data\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(1, "iov test ok\n");
+}
+
+// O_SYNC, O_DIRECT and fsync() must not change what is read back.
+void
+synctest(void)
+{
+  int fd, i;
+
+  printf(1, "sync test\n");
+
+  fd = open("syncf", O_CREATE|O_RDWR|O_SYNC);
+  if(fd < 0){
+    printf(1, "error: creat syncf failed!\n");
+    exit();
+  }
+  for(i = 0; i < 8; i++){
+    memset(buf, 'a' + i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "error: O_SYNC write failed\n");
+      exit();
+    }
+  }
+  if(fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf(1, "error: fsync failed\n");
+    exit();
+  }
+  close(fd);
+
+  // Overwrite blocks 2-3 directly, then read them back
+  // both directly and through the cache.
+  fd = open("syncf", O_RDWR|O_DIRECT);
+  memset(buf, 'D', 1024);
+  if(pwrite(fd, buf, 1024, 1024) != 1024){
+    printf(1, "error: O_DIRECT write failed\n");
+    exit();
+  }
+  if(read(fd, buf, 4096) != 4096 || buf[0] != 'a' || buf[1024] != 'D' ||
+     buf[2047] != 'D' || buf[2048] != 'e'){
+    printf(1, "error: O_DIRECT read got the wrong data\n");
+    exit();
+  }
+  close(fd);
+  fd = open("syncf", O_RDONLY);
+  if(pread(fd, buf, 512, 1536) != 512 || buf[0] != 'D' || buf[511] != 'D'){
+    printf(1, "error: O_DIRECT write not seen through the cache\n");
+    exit();
+  }
+  close(fd);
+  unlink("syncf");
+  printf(1, "sync test ok\n");
+}
+
+// Time nproc processes each reading the same file over and
+// over. Readers share the inode lock, so more of them should
+// not mean proportionally more ticks.
+void
+readbench(void)
+{
+  int fd, i, n, nproc, pid, start;
+  char rbuf[512];
+
+  printf(1, "read bench\n");
+
+  fd = open("rbench", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "error: creat rbench failed!\n");
+    exit();
+  }
+  memset(buf, 'r', sizeof(buf));
+  for(i = 0; i < 4; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "error: write rbench failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  for(nproc = 1; nproc <= 8; nproc *= 2){
+    start = uptime();
+    for(i = 0; i < nproc; i++){
+      pid = fork();
+      if(pid < 0){
+        printf(1, "fork failed\n");
+        exit();
+      }
+      if(pid == 0){
+        for(n = 0; n < 20; n++){
+          if((fd = open("rbench", O_RDONLY)) < 0){
+            printf(1, "error: open rbench failed\n");
+            exit();
+          }
+          while(read(fd, rbuf, sizeof(rbuf)) > 0)
+            ;
+          close(fd);
+        }
+        exit();
+      }
+    }
+    for(i = 0; i < nproc; i++)
+      wait();
+    printf(1, "read bench: %d readers, %d ticks\n", nproc, uptime() - start);
+  }
+
+  unlink("rbench");
+  printf(1, "read bench ok\n");
+}
+
+// Pipe throughput: push 4MB through a pipe in writes of
+// several sizes and check that every byte arrives in order.
+void
+pipebench(void)
+{
+  int fds[2], pid, sz, n, tot, start, i;
+  uint seq;
+
+  printf(1, "pipe bench\n");
+
+  for(sz = 512; sz <= sizeof(buf); sz *= 4){
+    if(pipe(fds) != 0){
+      printf(1, "pipe() failed\n");
+      exit();
+    }
+    start = uptime();
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(fds[0]);
+      for(seq = 0, tot = 0; tot < 4*1024*1024; tot += sz){
+        for(i = 0; i < sz; i++)
+          buf[i] = seq++;
+        if(write(fds[1], buf, sz) != sz){
+          printf(1, "pipe bench: write failed\n");
+          exit();
+        }
+      }
+      exit();
+    }
+    close(fds[1]);
+    seq = 0;
+    while((n = read(fds[0], buf, sz)) > 0){
+      for(i = 0; i < n; i++){
+        if((buf[i] & 0xff) != (seq++ & 0xff)){
+          printf(1, "pipe bench: wrong data\n");
+          exit();
+        }
+      }
+    }
+    close(fds[0]);
+    wait();
+    if(seq != 4*1024*1024){
+      printf(1, "pipe bench: read %d bytes\n", seq);
+      exit();
+    }
+    printf(1, "pipe bench: %d byte writes, 4MB in %d ticks\n", sz, uptime() - start);
+  }
+  printf(1, "pipe bench ok\n");
+}
+
 unsigned long randstate = 1;
 unsigned int
 rand()
@@ -1796,6 +3308,29 @@ main(int argc, char *argv[])
   bigdir(); // slow
 
   uio();
+  fcopytest();
+  reflinktest();
+  reflinkquotatest();
+  quotafilltest();
+  overlaytest();
+  tmpfstest();
+  ramdisktest();
+  swaptest();
+  seektest();
+  iovtest();
+  synctest();
+  dentstest();
+  splicetest();
+  polltest();
+  nonblocktest();
+  futextest();
+  threadtest();
+  shmtest();
+  mmaptest();
+  anontest();
+  texttest();
+  readbench();
+  pipebench();
 
   exectest();
 
@@ -0,0 +1,52 @@
+// Threads for user programs, on top of clone() and join().
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define TSTACK 4096  // a thread's stack: one page, as clone() wants
+
+// Where a thread made by thread_create() starts. The first
+// two words of its stack page hold fn and arg.
+static void
+threadstart(void *stack)
+{
+  void (*fn)(void*) = ((void**)stack)[0];
+
+  fn(((void**)stack)[1]);
+  exit();
+}
+
+// Run fn(arg) in a new thread sharing this process's memory.
+// Returns the thread's pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  char *p, *stack;
+  int pid;
+
+  // clone() wants a page-aligned stack; keep what malloc()
+  // returned in the word below it, for thread_join().
+  if((p = malloc(2*TSTACK)) == 0)
+    return -1;
+  stack = (char*)(((uint)p + TSTACK) & ~(TSTACK-1));
+  ((char**)stack)[-1] = p;
+  ((void**)stack)[0] = fn;
+  ((void**)stack)[1] = arg;
+  if((pid = clone(threadstart, stack, stack)) < 0)
+    free(p);
+  return pid;
+}
+
+// Wait for a thread made by thread_create() to finish and
+// free its stack. Returns its pid, or -1 if there are none.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(((char**)stack)[-1]);
+  return pid;
+}
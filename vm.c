@@ -6,6 +6,8 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "mman.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -224,7 +226,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > MMAPBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -275,6 +277,9 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_S){
+      swapfree(PTE_ADDR(*pte) / PGSIZE);
+      *pte = 0;
     }
   }
   return newsz;
@@ -313,7 +318,10 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. Read-only pages, which exec() maps from
+// the page cache, are shared rather than copied, and those
+// not faulted in yet are left for the child to fault in.
+// Pages in swap space are read into the child's copy.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
@@ -325,12 +333,26 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & (PTE_P|PTE_S)))
+      continue;
+    if(*pte & PTE_S){
+      if((mem = kalloc()) == 0)
+        goto bad;
+      swapread(PTE_ADDR(*pte) / PGSIZE, mem);
+      if(mappages(d, (void*)i, PGSIZE, V2P(mem), PTE_FLAGS(*pte) & ~PTE_S) < 0){
+        kfree(mem);
+        goto bad;
+      }
+      continue;
+    }
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
+    if(!(flags & PTE_W)){
+      if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+        goto bad;
+      kref(P2V(pa));
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
@@ -352,7 +374,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -385,6 +407,588 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   return 0;
 }
 
+//PAGEBREAK!
+// Mappings above the heap, between MMAPBASE and KERNBASE.
+// An address space's mappings are listed in its vmspace,
+// which its threads share and which lives as long as its
+// page table. A mapping is a shared memory segment (see
+// shm.c), whose pages are always present, part of a file, or
+// anonymous memory. exec() also maps the read-only segments of
+// a program, below the heap, as private mappings of its file.
+// vmfault() maps the pages of a file from the page cache (see
+// pcache.c), and zero-filled pages for anonymous memory, when
+// they are first used. A private mapping of a file shares the
+// cached pages until it writes to one, and then gets a copy of
+// that page of its own.
+
+struct vma {
+  uint start;         // first address
+  uint end;           // address just past the last page, or 0 if the slot is free
+  int prot;           // PROT_ bits
+  int flags;          // MAP_ bits
+  struct inode *ip;   // file mapped here, or 0
+  uint off;           // offset in ip of the first page
+  int shm;            // shared memory segment mapped here, or -1
+};
+
+struct vmspace {
+  struct spinlock lock;
+  struct vma vma[NVMA];
+};
+
+// Make an empty vmspace.
+struct vmspace*
+vmsalloc(void)
+{
+  struct vmspace *vms;
+
+  if(sizeof(*vms) > PGSIZE)
+    panic("vmsalloc");
+  if((vms = (struct vmspace*)kalloc()) == 0)
+    return 0;
+  memset(vms, 0, sizeof(*vms));
+  initlock(&vms->lock, "vmspace");
+  return vms;
+}
+
+// Return p's vmspace, making an empty one if it has none.
+struct vmspace*
+vmsget(struct proc *p)
+{
+  if(p->vms == 0)
+    p->vms = vmsalloc();
+  return p->vms;
+}
+
+// Find the free range of n bytes lowest in the mapping area.
+// Caller must hold vms->lock.
+static uint
+vmfindgap(struct vmspace *vms, uint n)
+{
+  struct vma *v;
+  uint a;
+
+  for(a = MMAPBASE; a + n <= KERNBASE && a + n > a; ){
+    for(v = vms->vma; v < &vms->vma[NVMA]; v++)
+      if(v->end && v->start < a + n && a < v->end)
+        break;
+    if(v == &vms->vma[NVMA])
+      return a;
+    a = v->end;
+  }
+  return 0;
+}
+
+// Claim a slot for a mapping of n bytes, a multiple of PGSIZE,
+// at the lowest free address. Returns 0 if there is no room.
+// Caller must hold vms->lock.
+static struct vma*
+vmaalloc(struct vmspace *vms, uint n)
+{
+  struct vma *v;
+  uint start;
+
+  for(v = vms->vma; v < &vms->vma[NVMA]; v++)
+    if(v->end == 0)
+      break;
+  if(v == &vms->vma[NVMA] || (start = vmfindgap(vms, n)) == 0)
+    return 0;
+  memset(v, 0, sizeof(*v));
+  v->start = start;
+  v->end = start + n;
+  v->shm = -1;
+  return v;
+}
+
+// Drop a mapping's hold on its segment and file.
+static void
+vmadrop(int shm, struct inode *ip)
+{
+  if(shm >= 0)
+    shmrelease(shm);
+  if(ip){
+    begin_op();
+    iput(ip);
+    end_op();
+  }
+}
+
+// Remove the PTEs for [start, end) and drop the pages'
+// references, or free their swap slots. Caller must hold
+// vms->lock.
+static void
+vmunmappages(pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0)
+      continue;
+    if(*pte & PTE_P){
+      kfree(P2V(PTE_ADDR(*pte)));
+      *pte = 0;
+    } else if(*pte & PTE_S){
+      swapfree(PTE_ADDR(*pte) / PGSIZE);
+      *pte = 0;
+    }
+  }
+}
+
+// Map the n pages in pages[] into p, writable and shared, at
+// the lowest free address, as segment shm. Each page gains a
+// reference. Returns the address, or 0 if there is no room.
+uint
+vmmapshm(struct proc *p, char **pages, int n, int shm)
+{
+  struct vmspace *vms;
+  struct vma *v;
+  uint start;
+  int i;
+
+  if((vms = vmsget(p)) == 0)
+    return 0;
+  acquire(&vms->lock);
+  if((v = vmaalloc(vms, n*PGSIZE)) == 0){
+    release(&vms->lock);
+    return 0;
+  }
+  for(i = 0; i < n; i++){
+    if(mappages(p->pgdir, (char*)v->start + i*PGSIZE, PGSIZE, V2P(pages[i]), PTE_W|PTE_U) < 0){
+      vmunmappages(p->pgdir, v->start, v->start + i*PGSIZE);
+      v->start = v->end = 0;
+      release(&vms->lock);
+      return 0;
+    }
+    kref(pages[i]);
+  }
+  v->prot = PROT_READ|PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->shm = shm;
+  start = v->start;
+  release(&vms->lock);
+  return start;
+}
+
+// Map len bytes of ip, from offset off, a multiple of PGSIZE,
+// into p at the lowest free address, or len bytes of anonymous
+// memory if ip is 0. No pages are mapped until they are used.
+// The mapping holds a reference to ip.
+// Returns the address, or 0 if there is no room.
+uint
+vmmap(struct proc *p, struct inode *ip, uint off, uint len, int prot, int flags)
+{
+  struct vmspace *vms;
+  struct vma *v;
+  uint start;
+
+  if((vms = vmsget(p)) == 0)
+    return 0;
+  acquire(&vms->lock);
+  if((v = vmaalloc(vms, PGROUNDUP(len))) == 0){
+    release(&vms->lock);
+    return 0;
+  }
+  v->prot = prot;
+  v->flags = flags;
+  v->ip = ip ? idup(ip) : 0;
+  v->off = off;
+  start = v->start;
+  release(&vms->lock);
+  return start;
+}
+
+// Map n bytes of ip, from offset off, read-only at va in the
+// program that exec() is building in vms. va and off are
+// multiples of PGSIZE. The pages are the page cache's, shared
+// by every process running the program, and are faulted in
+// when first used. Returns 0, or -1 if out of slots.
+int
+vmmaptext(struct vmspace *vms, struct inode *ip, uint va, uint off, uint n)
+{
+  struct vma *v;
+
+  for(v = vms->vma; v < &vms->vma[NVMA]; v++)
+    if(v->end == 0)
+      break;
+  if(v == &vms->vma[NVMA] || n == 0)
+    return -1;
+  memset(v, 0, sizeof(*v));
+  v->start = va;
+  v->end = PGROUNDUP(va + n);
+  v->prot = PROT_READ;
+  v->flags = MAP_PRIVATE;
+  v->ip = idup(ip);
+  v->off = off;
+  v->shm = -1;
+  return 0;
+}
+
+// Remove p's mappings of [addr, addr+len), or the whole
+// mapping that starts at addr if len is 0. A mapping that
+// loses only part of its pages shrinks, or is split in two if
+// the hole is in its middle; one that loses all of them drops
+// its hold on its segment or file. The pages are freed, and
+// credited to their container, as soon as nothing else has
+// them. Returns 0, or -1 if nothing was mapped there.
+// Threads sharing p's memory would keep stale TLB entries
+// on other CPUs, so this fails if there are any.
+int
+vmunmap(struct proc *p, uint addr, uint len)
+{
+  struct vmspace *vms;
+  struct vma *v, *nv;
+  struct inode *ip;
+  uint end, lo, hi;
+  int shm, found;
+
+  if((vms = p->vms) == 0 || addr < MMAPBASE || addr % PGSIZE != 0 ||
+     addr + len < addr || vmshared(p))
+    return -1;
+  end = PGROUNDUP(addr + len);
+  if(len == 0){
+    acquire(&vms->lock);
+    for(v = vms->vma; v < &vms->vma[NVMA]; v++)
+      if(v->end && v->start == addr)
+        end = v->end;
+    release(&vms->lock);
+    if(end == addr)
+      return -1;
+  }
+
+  // One mapping at a time, so that holds can be dropped
+  // without vms->lock.
+  for(found = 0; ; found = 1){
+    acquire(&vms->lock);
+    for(v = vms->vma; v < &vms->vma[NVMA]; v++)
+      if(v->end && v->start < end && addr < v->end)
+        break;
+    if(v == &vms->vma[NVMA]){
+      release(&vms->lock);
+      break;
+    }
+    lo = v->start > addr ? v->start : addr;
+    hi = v->end < end ? v->end : end;
+    if(v->start < lo && hi < v->end){
+      // The part above the hole needs a slot of its own.
+      for(nv = vms->vma; nv < &vms->vma[NVMA]; nv++)
+        if(nv->end == 0)
+          break;
+      if(nv == &vms->vma[NVMA]){
+        release(&vms->lock);
+        return -1;
+      }
+      *nv = *v;
+      nv->start = hi;
+      nv->off += hi - v->start;
+      if(nv->shm >= 0)
+        shmhold(nv->shm);
+      if(nv->ip)
+        idup(nv->ip);
+      v->end = hi;
+    }
+    vmunmappages(p->pgdir, lo, hi);
+    shm = -1;
+    ip = 0;
+    if(lo == v->start && hi == v->end){
+      shm = v->shm;
+      ip = v->ip;
+      v->start = v->end = 0;
+      v->ip = 0;
+    } else if(lo == v->start){
+      v->off += hi - v->start;
+      v->start = hi;
+    } else
+      v->end = lo;
+    release(&vms->lock);
+    vmadrop(shm, ip);
+  }
+  if(found && p == myproc())
+    lcr3(V2P(p->pgdir));  // flush the TLB
+  return found ? 0 : -1;
+}
+
+// Handle p's fault on the page at va, which was a write if
+// write is set: read the page back in from swap space, map
+// the page of a file from the page cache, or give a private
+// mapping its own copy of a shared page it writes to.
+// Returns 0 if the access can be retried, or -1 if p may not
+// make it.
+int
+vmfault(struct proc *p, uint va, int write)
+{
+  struct vmspace *vms;
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  char *page, *mem;
+  uint a, off;
+  int anon, priv;
+
+  a = PGROUNDDOWN(va);
+  if((pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_S))
+    return swapin(pte);
+  if((vms = p->vms) == 0)
+    return -1;
+  acquire(&vms->lock);
+  for(v = vms->vma; v < &vms->vma[NVMA]; v++)
+    if(v->end && v->start <= a && a < v->end)
+      break;
+  if(v == &vms->vma[NVMA] || (write && !(v->prot & PROT_WRITE)) ||
+     (v->start < MMAPBASE && a >= p->sz)){
+    release(&vms->lock);
+    return -1;
+  }
+  if((pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_P)){
+    if(write && !(*pte & PTE_W)){
+      // Copy on write, unless no one else has the page.
+      page = P2V(PTE_ADDR(*pte));
+      if(krefs(page) > 1){
+        if((mem = kalloc()) == 0){
+          release(&vms->lock);
+          return -1;
+        }
+        memmove(mem, page, PGSIZE);
+        *pte = V2P(mem) | PTE_FLAGS(*pte);
+        kfree(page);
+      }
+      *pte |= PTE_W;
+      if(p == myproc())
+        lcr3(V2P(p->pgdir));  // flush the TLB
+    }
+    release(&vms->lock);
+    return 0;
+  }
+  ip = v->ip;
+  off = v->off + (a - v->start);
+  priv = (v->flags & MAP_PRIVATE) != 0;
+  anon = ip == 0 && v->shm < 0;
+  if(anon)
+    write = (v->prot & PROT_WRITE) != 0;
+  release(&vms->lock);
+  if(ip == 0 && !anon)
+    return -1;  // segments' pages are always present
+
+  if(anon){
+    if((page = kalloc()) == 0)
+      return -1;
+    memset(page, 0, PGSIZE);
+  } else {
+    // Reading the page may sleep. Only p's own threads could
+    // change its mappings meanwhile, and vmunmap() refuses to
+    // while there are any, so ip stays referenced.
+    if((page = pcget(ip, off, priv)) == 0)
+      return -1;
+    if(write){
+      if((mem = kalloc()) == 0){
+        kfree(page);
+        return -1;
+      }
+      memmove(mem, page, PGSIZE);
+      kfree(page);
+      page = mem;
+    }
+  }
+  acquire(&vms->lock);
+  if((pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_P)){
+    // Another thread mapped it first.
+    release(&vms->lock);
+    kfree(page);
+    return 0;
+  }
+  if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(page), write ? PTE_W|PTE_U : PTE_U) < 0){
+    release(&vms->lock);
+    kfree(page);
+    return -1;
+  }
+  release(&vms->lock);
+  return 0;
+}
+
+// Give np, a fork of p with page table pgdir, the same
+// mappings as p. Pages are shared, not copied, except those
+// a private mapping has already written to, which may be in
+// swap space.
+// Returns 0, or -1 if out of memory.
+int
+vmsdup(struct proc *p, struct proc *np)
+{
+  struct vmspace *vms, *nvms;
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  uint a;
+
+  np->vms = 0;
+  if((vms = p->vms) == 0)
+    return 0;
+  if((nvms = vmsget(np)) == 0)
+    return -1;
+  acquire(&vms->lock);
+  for(v = vms->vma; v < &vms->vma[NVMA]; v++){
+    if(v->end == 0)
+      continue;
+    // copyuvm() has dealt with the pages below the heap.
+    for(a = v->start; a < v->end && v->start >= MMAPBASE; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & (PTE_P|PTE_S)))
+        continue;
+      if((v->flags & MAP_PRIVATE) && (*pte & PTE_W)){
+        if((mem = kalloc()) == 0)
+          goto bad;
+        if(*pte & PTE_S)
+          swapread(PTE_ADDR(*pte) / PGSIZE, mem);
+        else
+          memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+        if(mappages(np->pgdir, (char*)a, PGSIZE, V2P(mem), PTE_FLAGS(*pte) & ~PTE_S) < 0){
+          kfree(mem);
+          goto bad;
+        }
+        continue;
+      }
+      if(mappages(np->pgdir, (char*)a, PGSIZE, PTE_ADDR(*pte), PTE_FLAGS(*pte)) < 0)
+        goto bad;
+      kref(P2V(PTE_ADDR(*pte)));
+    }
+    nvms->vma[v - vms->vma] = *v;
+    if(v->shm >= 0)
+      shmhold(v->shm);
+    if(v->ip)
+      idup(v->ip);
+  }
+  release(&vms->lock);
+  return 0;
+
+bad:
+  release(&vms->lock);
+  return -1;
+}
+
+// Free an address space: the pages of page table pgdir and
+// the mappings in vms, if any.
+void
+freeuvm(pde_t *pgdir, struct vmspace *vms)
+{
+  struct vma *v;
+
+  freevm(pgdir);
+  if(vms == 0)
+    return;
+  for(v = vms->vma; v < &vms->vma[NVMA]; v++)
+    if(v->end)
+      vmadrop(v->shm, v->ip);
+  kfree((char*)vms);
+}
+
+// Fault in whatever pages of [addr, addr+n), which lies below
+// p's size, exec() mapped from the program's file and p has
+// not used yet, or are in swap space, so that the kernel may
+// use them; they must be writable if write is set. Returns 0,
+// or -1 if they cannot be used so.
+int
+vmfaultin(struct proc *p, uint addr, uint n, int write)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(addr); a < addr + n; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P) && (!write || (*pte & PTE_W)))
+      continue;
+    if(vmfault(p, a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Whether [addr, addr+n) lies within p's mappings, and may be
+// written if write is set, so that the kernel may use it.
+// Pages that are not present yet are faulted in, so that the
+// kernel's own accesses to them do not fault.
+int
+vmvalid(struct proc *p, uint addr, uint n, int write)
+{
+  uint a;
+
+  if(addr + n < addr)
+    return 0;
+  for(a = PGROUNDDOWN(addr); a < addr + n; a += PGSIZE)
+    if(vmfault(p, a, write) < 0)
+      return 0;
+  return 1;
+}
+
+// The page after a in the part of p's address space that
+// vmswapout() pages out: the heap, from 0 up to p's size, then
+// the private mappings above it. Returns 0 after the last.
+static uint
+vmnextpage(struct proc *p, uint a)
+{
+  struct vma *v;
+  uint next;
+
+  a += PGSIZE;
+  if(a < p->sz)
+    return a;
+  if(p->vms == 0 || a < PGSIZE)
+    return 0;
+  next = 0;
+  acquire(&p->vms->lock);
+  for(v = p->vms->vma; v < &p->vms->vma[NVMA]; v++){
+    if(v->end == 0 || v->start < MMAPBASE || !(v->flags & MAP_PRIVATE) || v->end <= a)
+      continue;
+    if(v->start <= a){
+      next = a;
+      break;
+    }
+    if(next == 0 || v->start < next)
+      next = v->start;
+  }
+  release(&p->vms->lock);
+  return next;
+}
+
+// Page out up to n of the current process p's pages to swap
+// space. A clock hand passes over the pages p alone has and
+// may write, and takes the first it finds that has not been
+// used since the hand last passed; used ones lose their
+// accessed bit and are passed over. Threads sharing p's
+// memory are stopped meanwhile (see stopthreads).
+// Returns the number paged out, or -1 if swap space is full.
+int
+vmswapout(struct proc *p, int n)
+{
+  pte_t *pte;
+  char *page;
+  uint a;
+  int slot, out, wraps;
+
+  stopthreads(p);
+  out = 0;
+  a = p->swaphand;
+  for(wraps = 0; out < n && wraps < 3; ){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & (PTE_P|PTE_U|PTE_W)) == (PTE_P|PTE_U|PTE_W) &&
+       krefs(page = P2V(PTE_ADDR(*pte))) == 1){
+      if(*pte & PTE_A)
+        *pte &= ~PTE_A;
+      else if((slot = swapout(page)) < 0){
+        out = -1;
+        break;
+      } else {
+        *pte = slot*PGSIZE | (PTE_FLAGS(*pte) & ~PTE_P) | PTE_S;
+        kfree(page);
+        out++;
+      }
+    }
+    if((a = vmnextpage(p, a)) == 0)
+      wraps++;
+  }
+  p->swaphand = a;
+  lcr3(V2P(p->pgdir));  // flush the TLB
+  startthreads(p);
+  return out;
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!
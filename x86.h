@@ -18,6 +18,16 @@ insl(int port, void *addr, int cnt)
                "memory", "cc");
 }
 
+// Low 32 bits of the time-stamp counter.
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
 static inline void
 outb(ushort port, uchar data)
 {
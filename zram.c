@@ -0,0 +1,308 @@
+// Compressed swap space: a pool of memory that pages going to
+// swap space are compressed into before any go to the disk
+// (see swap.c), so that most pages come back in with a
+// decompression rather than a disk read.
+//
+// The pool is ZRAMPAGES pages, set aside at boot and cut into
+// ZCHUNK-byte chunks. A compressed page takes as many chunks
+// as it needs, chained through zram.next, and is known by its
+// first chunk. Pages that do not compress to ZMAXLEN bytes, or
+// that do not fit, are left to the disk.
+//
+// The compressor is LZ77 in LZ4's block format: runs of
+// literal bytes, each followed by a copy of up to 4+ bytes from
+// earlier in the page, found through a hash of the next four
+// bytes. It is fast rather than thorough.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+
+#define CPP       (PGSIZE/ZCHUNK)      // chunks per pool page
+#define NZCHUNK   (ZRAMPAGES*CPP)
+#define ZMAXLEN   (PGSIZE*3/4)         // pages that compress worse go to disk
+#define MINMATCH  4
+#define HASHBITS  10
+
+struct {
+  struct spinlock lock;        // protects the chunks and counters
+  struct sleeplock buflock;    // protects buf and hash
+  char *pool[ZRAMPAGES];
+  short next[NZCHUNK];         // next chunk of a page, or of the free list; -1 ends
+  short len[NZCHUNK];          // compressed length, in a page's first chunk
+  int free;                    // first free chunk, or -1
+  int nfree;
+  uchar buf[PGSIZE];           // compressed page, contiguous
+  ushort hash[1<<HASHBITS];    // last offset seen with each hash
+  uint pages;                  // pages in the pool
+  uint bytes;                  // their compressed size
+  uint rejects;                // pages that did not compress well enough
+  uint full;                   // pages there was no room for
+} zram;
+
+void
+zraminit(void)
+{
+  int i;
+
+  initlock(&zram.lock, "zram");
+  initsleeplock(&zram.buflock, "zrambuf");
+  zram.free = -1;
+  for(i = 0; i < ZRAMPAGES; i++)
+    if((zram.pool[i] = kalloc()) == 0)
+      break;
+  for(i = i*CPP - 1; i >= 0; i--){
+    zram.next[i] = zram.free;
+    zram.free = i;
+    zram.nfree++;
+  }
+}
+
+static char*
+chunk(int c)
+{
+  return zram.pool[c / CPP] + (c % CPP) * ZCHUNK;
+}
+
+static uint
+lzhash(uchar *p)
+{
+  return (*(uint*)p * 2654435761U) >> (32 - HASHBITS);
+}
+
+// Append to dst at op the part of a run length n that did
+// not fit in the token: 255s, then what is left.
+// Returns the new op, or -1 if that would pass cap.
+static int
+lzputlen(uchar *dst, int op, int cap, int n)
+{
+  for(; n >= 255; n -= 255){
+    if(op >= cap)
+      return -1;
+    dst[op++] = 255;
+  }
+  if(op >= cap)
+    return -1;
+  dst[op++] = n;
+  return op;
+}
+
+// Append to dst at op a sequence: nlit bytes of lit, then a
+// copy of len bytes from off bytes back, or nothing if len is
+// 0, as it is for the last sequence of a page.
+// Returns the new op, or -1 if that would pass cap.
+static int
+lzputseq(uchar *dst, int op, int cap, uchar *lit, int nlit, int off, int len)
+{
+  int t;
+
+  if(op >= cap)
+    return -1;
+  t = len ? len - MINMATCH : 0;
+  dst[op++] = (nlit < 15 ? nlit : 15) << 4 | (t < 15 ? t : 15);
+  if(nlit >= 15 && (op = lzputlen(dst, op, cap, nlit - 15)) < 0)
+    return -1;
+  if(op + nlit > cap)
+    return -1;
+  memmove(dst + op, lit, nlit);
+  op += nlit;
+  if(len == 0)
+    return op;
+  if(op + 2 > cap)
+    return -1;
+  dst[op++] = off;
+  dst[op++] = off >> 8;
+  if(t >= 15 && (op = lzputlen(dst, op, cap, t - 15)) < 0)
+    return -1;
+  return op;
+}
+
+// Compress the page at src into at most cap bytes at dst.
+// Returns the compressed length, or -1 if it does not fit.
+// Caller must hold zram.buflock, for the hash table.
+static int
+lzcompress(uchar *src, uchar *dst, int cap)
+{
+  ushort *tab = zram.hash;
+  int ip, anchor, op, ref, len;
+  uint h;
+
+  // An empty entry says 0, which is only ever taken for a
+  // match once the bytes there have been checked.
+  memset(tab, 0, sizeof(zram.hash));
+  ip = anchor = op = 0;
+  while(ip + MINMATCH <= PGSIZE){
+    h = lzhash(src + ip);
+    ref = tab[h];
+    tab[h] = ip;
+    if(ref >= ip || *(uint*)(src + ref) != *(uint*)(src + ip)){
+      ip++;
+      continue;
+    }
+    len = MINMATCH;
+    while(ip + len < PGSIZE && src[ref + len] == src[ip + len])
+      len++;
+    op = lzputseq(dst, op, cap, src + anchor, ip - anchor, ip - ref, len);
+    if(op < 0)
+      return -1;
+    ip += len;
+    anchor = ip;
+  }
+  return lzputseq(dst, op, cap, src + anchor, PGSIZE - anchor, 0, 0);
+}
+
+// Add the rest of a run length, at src[*ip], to *len.
+// Returns -1 if it runs past n bytes of input.
+static int
+lzgetlen(uchar *src, int *ip, int n, int *len)
+{
+  do {
+    if(*ip >= n)
+      return -1;
+    *len += src[*ip];
+  } while(src[(*ip)++] == 255);
+  return 0;
+}
+
+// Decompress the n bytes at src into the page at dst.
+// Returns 0, or -1 if they are not a compressed page.
+static int
+lzdecompress(uchar *src, int n, uchar *dst)
+{
+  int ip, op, t, nlit, len, off;
+
+  ip = op = 0;
+  for(;;){
+    if(ip >= n)
+      return -1;
+    t = src[ip++];
+    nlit = t >> 4;
+    if(nlit == 15 && lzgetlen(src, &ip, n, &nlit) < 0)
+      return -1;
+    if(nlit > PGSIZE - op || nlit > n - ip)
+      return -1;
+    memmove(dst + op, src + ip, nlit);
+    op += nlit;
+    ip += nlit;
+    if(op == PGSIZE)
+      return 0;
+    if(ip + 2 > n)
+      return -1;
+    off = src[ip] | src[ip+1] << 8;
+    ip += 2;
+    len = t & 15;
+    if(len == 15 && lzgetlen(src, &ip, n, &len) < 0)
+      return -1;
+    len += MINMATCH;
+    if(off == 0 || off > op || len > PGSIZE - op)
+      return -1;
+    // Byte by byte, since the copy may overlap what it makes.
+    for(; len > 0; len--, op++)
+      dst[op] = dst[op - off];
+  }
+}
+
+// Compress page into the pool. Returns its slot there, or
+// -1 if it does not compress well enough or there is no room.
+int
+zstore(char *page)
+{
+  int n, need, c, first, last, i;
+
+  acquiresleep(&zram.buflock);
+  n = lzcompress((uchar*)page, zram.buf, ZMAXLEN);
+  acquire(&zram.lock);
+  if(n < 0){
+    zram.rejects++;
+    release(&zram.lock);
+    releasesleep(&zram.buflock);
+    return -1;
+  }
+  need = (n + ZCHUNK - 1) / ZCHUNK;
+  if(need > zram.nfree){
+    zram.full++;
+    release(&zram.lock);
+    releasesleep(&zram.buflock);
+    return -1;
+  }
+  first = last = -1;
+  for(i = 0; i < need; i++){
+    c = zram.free;
+    zram.free = zram.next[c];
+    if(last < 0)
+      first = c;
+    else
+      zram.next[last] = c;
+    last = c;
+    memmove(chunk(c), zram.buf + i*ZCHUNK, i < need-1 ? ZCHUNK : n - i*ZCHUNK);
+  }
+  zram.next[last] = -1;
+  zram.len[first] = n;
+  zram.nfree -= need;
+  zram.pages++;
+  zram.bytes += n;
+  release(&zram.lock);
+  releasesleep(&zram.buflock);
+  return first;
+}
+
+// Decompress the page in slot z into page, leaving it in
+// the pool.
+void
+zload(int z, char *page)
+{
+  int c, n, i;
+
+  acquiresleep(&zram.buflock);
+  acquire(&zram.lock);
+  n = zram.len[z];
+  for(c = z, i = 0; c >= 0; c = zram.next[c], i += ZCHUNK)
+    memmove(zram.buf + i, chunk(c), n - i < ZCHUNK ? n - i : ZCHUNK);
+  release(&zram.lock);
+  if(lzdecompress(zram.buf, n, (uchar*)page) < 0)
+    panic("zload");
+  releasesleep(&zram.buflock);
+}
+
+// Free slot z's chunks.
+void
+zfree(int z)
+{
+  int c, last;
+
+  acquire(&zram.lock);
+  if(z < 0 || z >= NZCHUNK || zram.len[z] == 0)
+    panic("zfree");
+  zram.pages--;
+  zram.bytes -= zram.len[z];
+  zram.len[z] = 0;
+  for(c = z; c >= 0; c = zram.next[c]){
+    last = c;
+    zram.nfree++;
+  }
+  zram.next[last] = zram.free;
+  zram.free = z;
+  release(&zram.lock);
+}
+
+// Print how full the pool is and how well its pages have
+// compressed. Returns the number of pages in the pool.
+int
+zdump(void)
+{
+  uint r;
+  int n;
+
+  acquire(&zram.lock);
+  r = zram.bytes ? zram.pages * PGSIZE * 10 / zram.bytes : 0;
+  cprintf("Compressed swap: %d pages in %d bytes, ratio %d.%d, %d of %d chunks free, "
+          "%d incompressible, %d did not fit\n",
+          zram.pages, zram.bytes, r / 10, r % 10, zram.nfree, NZCHUNK,
+          zram.rejects, zram.full);
+  n = zram.pages;
+  release(&zram.lock);
+  return n;
+}